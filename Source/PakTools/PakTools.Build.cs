@@ -7,18 +7,29 @@ public class PakTools : ModuleRules {
         : base(Target) {
         PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
 
-        PrivateDependencyModuleNames.AddRange(new[] {
-            "Core",
-            "CoreUObject",
-            "AssetRegistry",
-            "PakFile",
-            "Json",
-            "Projects",
-            "PakFileUtilities",
-            "RSA",
-            "ApplicationCore",
-            "Json",
-        });
+        // PakToolsLite.Target.cs only links what reading and extracting containers needs
+        if (Target.Name == "PakToolsLite") {
+            PrivateDependencyModuleNames.AddRange(new[] {
+                "Core",
+                "PakFile",
+                "Json",
+                "RSA",
+                "ApplicationCore",
+            });
+        } else {
+            PrivateDependencyModuleNames.AddRange(new[] {
+                "Core",
+                "CoreUObject",
+                "AssetRegistry",
+                "PakFile",
+                "Json",
+                "Projects",
+                "PakFileUtilities",
+                "RSA",
+                "ApplicationCore",
+                "Json",
+            });
+        }
 
         // Hack to get private includes from Core
         Console.WriteLine("Unreal.EngineDirectory: " + Unreal.EngineDirectory);
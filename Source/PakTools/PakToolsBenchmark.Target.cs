@@ -0,0 +1,10 @@
+using UnrealBuildTool;
+using System.Collections.Generic;
+
+public class PakToolsBenchmarkTarget : PakToolsTarget {
+    public PakToolsBenchmarkTarget(TargetInfo Target)
+        : base(Target) {
+        // Same program, main() generates synthetic containers and benchmarks -List, -Extract and -Verify on them
+        GlobalDefinitions.Add("PAKTOOLS_BENCHMARK=1");
+    }
+}
@@ -0,0 +1,16 @@
+using UnrealBuildTool;
+using System.Collections.Generic;
+
+public class PakToolsLiteTarget : PakToolsTarget {
+    public PakToolsLiteTarget(TargetInfo Target)
+        : base(Target) {
+        // Same program with the shortest startup, for scripts calling it many times: only Core, PakFile and the crypto and compression code they use
+        // are initialized. Plugins, CoreUObject, AssetRegistry and editor-only data are left out, so keys can only be given with -CryptoKeys=
+        bCompileWithPluginSupport = false;
+        bIncludePluginsForTargetPlatforms = false;
+        bBuildWithEditorOnlyData = false;
+        bCompileAgainstCoreUObject = false;
+
+        GlobalDefinitions.Add("PAKTOOLS_LITE=1");
+    }
+}
@@ -0,0 +1,358 @@
+﻿#include "PakTools.h"
+
+#if PAKTOOLS_BENCHMARK
+
+#include "Dom/JsonObject.h"
+#include "IO/IoStore.h"
+#include "KeyChainUtilities.h"
+#include "Math/RandomStream.h"
+#include "Misc/Base64.h"
+#include "Misc/FileHelper.h"
+#include "PakFileUtilities.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+// Defined in PakFileUtilities.cpp
+void LoadKeyChain(const TCHAR *CmdLine, FKeyChain &OutCryptoSettings);
+
+namespace uetools {
+struct FBenchmarkSettings {
+    // Corpus: number of files, and their size range (log-uniform distribution)
+    int32 NumFiles = 2000;
+    int32 MinSizeKB = 1;
+    int32 MaxSizeKB = 1024;
+    // Share of each file filled with a repeated pattern, the rest is noise
+    float Compressibility = 0.5f;
+    // Compression method of both containers, "None" stores the data
+    FString CompressionMethod = TEXT("Zlib");
+    bool bEncrypt = false;
+    // Containers to generate and benchmark, "pak" and/or "utoc"
+    TArray<FString> Formats;
+    // Each scenario is run this many times, the best and mean times are reported
+    int32 Iterations = 3;
+    // Seed of the corpus generator, the same seed and settings generate the same containers
+    int32 Seed = 1;
+    FString WorkDir;
+    FString ReportFile;
+};
+
+struct FBenchmarkCorpus {
+    // Source file on disk and path inside the containers
+    TArray<TPair<FString, FString>> Files;
+    int64 TotalSize = 0;
+    FString CryptoKeysFile;
+};
+
+static const TCHAR *GBenchmarkMountPoint = TEXT("../../../Benchmark/");
+// Written in the work directory, only a directory carrying it is wiped by the next run
+static const TCHAR *GBenchmarkMarkerFile = TEXT(".PakToolsBenchmark");
+
+bool IsCompressed(const FBenchmarkSettings &settings) {
+    return !settings.CompressionMethod.IsEmpty() && settings.CompressionMethod != TEXT("None");
+}
+
+// Empties the work directory of a previous run, any other non-empty directory is left untouched
+bool PrepareWorkDir(const FString &workDir) {
+    TArray<FString> existingFiles;
+    IFileManager::Get().FindFiles(existingFiles, *(workDir / TEXT("*")), true, true);
+    if (existingFiles.Num() > 0) {
+        if (!IFileManager::Get().FileExists(*(workDir / GBenchmarkMarkerFile))) {
+            UE_LOG(LogPakFile, Error, TEXT("Work directory '%s' is not empty and was not created by the benchmark."), *workDir);
+            return false;
+        }
+        if (!IFileManager::Get().DeleteDirectory(*workDir, false, true)) {
+            UE_LOG(LogPakFile, Error, TEXT("Unable to delete work directory '%s'."), *workDir);
+            return false;
+        }
+    }
+
+    if (!IFileManager::Get().MakeDirectory(*workDir, true) || !FFileHelper::SaveStringToFile(FString(), *(workDir / GBenchmarkMarkerFile))) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to create work directory '%s'."), *workDir);
+        return false;
+    }
+    return true;
+}
+
+double GetPeakUsedPhysicalMB() {
+    return FPlatformMemory::GetStats().PeakUsedPhysical / 1024.0 / 1024.0;
+}
+
+void FillSyntheticData(FRandomStream &stream, float compressibility, TArray64<uint8> &outData) {
+    static const ANSICHAR Pattern[] = "PakTools synthetic benchmark data. ";
+    const int64 patternSize = int64(outData.Num() * FMath::Clamp(compressibility, 0.0f, 1.0f));
+    for (int64 index = 0; index < patternSize; index++) {
+        outData[index] = uint8(Pattern[index % (UE_ARRAY_COUNT(Pattern) - 1)]);
+    }
+    for (int64 index = patternSize; index < outData.Num(); index++) {
+        outData[index] = uint8(stream.GetUnsignedInt());
+    }
+}
+
+// Writes the corpus files and the crypto keys used by both containers
+bool GenerateCorpus(const FBenchmarkSettings &settings, FBenchmarkCorpus &outCorpus) {
+    FRandomStream stream(settings.Seed);
+    const double minSize = FMath::Max(settings.MinSizeKB, 0) * 1024.0 + 1.0;
+    const double maxSize = FMath::Max<double>(settings.MaxSizeKB * 1024.0, minSize);
+
+    TArray64<uint8> data;
+    for (int32 fileIndex = 0; fileIndex < settings.NumFiles; fileIndex++) {
+        const int64 size = int64(FMath::Exp(FMath::Lerp(FMath::Loge(minSize), FMath::Loge(maxSize), double(stream.GetFraction())))) - 1;
+        data.SetNumUninitialized(size);
+        FillSyntheticData(stream, settings.Compressibility, data);
+
+        const FString relativePath = FString::Printf(TEXT("Content/Dir%02d/File%05d.bin"), fileIndex % 16, fileIndex);
+        const FString sourcePath = settings.WorkDir / TEXT("Source") / relativePath;
+        if (!FFileHelper::SaveArrayToFile(data, *sourcePath)) {
+            UE_LOG(LogPakFile, Error, TEXT("Unable to write '%s'."), *sourcePath);
+            return false;
+        }
+        outCorpus.Files.Add({sourcePath, GBenchmarkMountPoint + relativePath});
+        outCorpus.TotalSize += size;
+    }
+
+    // The key is part of the corpus, so it comes from the same stream
+    uint8 key[FAES::FAESKey::KeySize];
+    for (uint8 &byte : key) {
+        byte = uint8(stream.GetUnsignedInt());
+    }
+    outCorpus.CryptoKeysFile = settings.WorkDir / TEXT("Crypto.json");
+    const FString cryptoKeys = FString::Printf(TEXT("{\"EncryptionKey\": {\"Name\": \"Benchmark\", \"Guid\": \"%s\", \"Key\": \"%s\"}}"), *FGuid().ToString(),
+                                               *FBase64::Encode(key, sizeof(key)));
+    return FFileHelper::SaveStringToFile(cryptoKeys, *outCorpus.CryptoKeysFile);
+}
+
+bool CreateBenchmarkPak(const FBenchmarkSettings &settings, const FBenchmarkCorpus &corpus, const FString &pakPath) {
+    const FString responseFile = settings.WorkDir / TEXT("PakList.txt");
+    const FString fileOptions = FString(IsCompressed(settings) ? TEXT(" -compress") : TEXT("")) + (settings.bEncrypt ? TEXT(" -encrypt") : TEXT(""));
+
+    TArray<FString> lines;
+    for (const TPair<FString, FString> &file : corpus.Files) {
+        lines.Add(FString::Printf(TEXT("\"%s\" \"%s\"%s"), *file.Key, *file.Value, *fileOptions));
+    }
+    if (!FFileHelper::SaveStringArrayToFile(lines, *responseFile)) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to write '%s'."), *responseFile);
+        return false;
+    }
+
+    FString commandLine = FString::Printf(TEXT("\"%s\" -create=\"%s\" -cryptokeys=\"%s\""), *pakPath, *responseFile, *corpus.CryptoKeysFile);
+    if (IsCompressed(settings)) {
+        commandLine += FString::Printf(TEXT(" -compressionformats=%s"), *settings.CompressionMethod);
+    }
+    return ExecuteUnrealPak(*commandLine);
+}
+
+bool CreateBenchmarkIoStore(const FBenchmarkSettings &settings, const FBenchmarkCorpus &corpus, const FKeyChain &keyChain, const FString &utocPath) {
+    FIoStoreWriterSettings writerSettings;
+    writerSettings.CompressionMethod = IsCompressed(settings) ? FName(*settings.CompressionMethod) : NAME_None;
+    writerSettings.CompressionBlockSize = 64 * 1024;
+
+    FIoStoreWriterContext writerContext;
+    const FIoStatus status = writerContext.Initialize(writerSettings);
+    if (!status.IsOk()) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to initialize the IoStore writer %s."), *status.ToString());
+        return false;
+    }
+
+    FIoContainerSettings containerSettings;
+    containerSettings.ContainerId = FIoContainerId::FromName(TEXT("PakToolsBenchmark"));
+    containerSettings.ContainerFlags = EIoContainerFlags::Indexed;
+    if (IsCompressed(settings)) {
+        containerSettings.ContainerFlags |= EIoContainerFlags::Compressed;
+    }
+    if (settings.bEncrypt) {
+        const FNamedAESKey *key = keyChain.GetPrincipalEncryptionKey();
+        check(key);
+        containerSettings.ContainerFlags |= EIoContainerFlags::Encrypted;
+        containerSettings.EncryptionKeyGuid = key->Guid;
+        containerSettings.EncryptionKey = key->Key;
+    }
+
+    TSharedPtr<IIoStoreWriter> writer = writerContext.CreateContainer(*FPaths::ChangeExtension(utocPath, TEXT("")), containerSettings);
+    TArray64<uint8> data;
+    for (int32 fileIndex = 0; fileIndex < corpus.Files.Num(); fileIndex++) {
+        const TPair<FString, FString> &file = corpus.Files[fileIndex];
+        if (!FFileHelper::LoadFileToArray(data, *file.Key)) {
+            UE_LOG(LogPakFile, Error, TEXT("Unable to read '%s'."), *file.Key);
+            return false;
+        }
+
+        FIoWriteOptions writeOptions;
+        writeOptions.FileName = file.Value;
+        writer->Append(CreateIoChunkId(fileIndex, 0, EIoChunkType::ExternalFile), FIoBuffer(FIoBuffer::Clone, data.GetData(), data.Num()), writeOptions);
+    }
+
+    writerContext.Flush();
+    return FPaths::FileExists(utocPath);
+}
+
+struct FBenchmarkScenario {
+    FString Container;
+    FString Name;
+    TArray<double> Seconds;
+    bool bSuccess = true;
+};
+
+// Runs one scenario settings.Iterations times, prepare is called before each run and is not timed
+FBenchmarkScenario RunScenario(const FBenchmarkSettings &settings, const FString &container, const FString &name, TFunctionRef<void()> prepare,
+                               TFunctionRef<bool()> run) {
+    FBenchmarkScenario scenario{container, name};
+    for (int32 iteration = 0; iteration < FMath::Max(settings.Iterations, 1); iteration++) {
+        prepare();
+        const double startTime = FPlatformTime::Seconds();
+        scenario.bSuccess &= run();
+        scenario.Seconds.Add(FPlatformTime::Seconds() - startTime);
+    }
+    return scenario;
+}
+
+TSharedRef<FJsonObject> WriteScenarioReport(const FBenchmarkScenario &scenario, const FBenchmarkCorpus &corpus) {
+    double bestSeconds = TNumericLimits<double>::Max();
+    double totalSeconds = 0;
+    TArray<TSharedPtr<FJsonValue>> iterations;
+    for (const double seconds : scenario.Seconds) {
+        bestSeconds = FMath::Min(bestSeconds, seconds);
+        totalSeconds += seconds;
+        iterations.Add(MakeShared<FJsonValueNumber>(seconds));
+    }
+    const double megabytes = corpus.TotalSize / 1024.0 / 1024.0;
+
+    TSharedRef<FJsonObject> report = MakeShared<FJsonObject>();
+    report->SetStringField(TEXT("Container"), scenario.Container);
+    report->SetStringField(TEXT("Scenario"), scenario.Name);
+    report->SetBoolField(TEXT("Success"), scenario.bSuccess);
+    report->SetArrayField(TEXT("Seconds"), iterations);
+    report->SetNumberField(TEXT("BestSeconds"), bestSeconds);
+    report->SetNumberField(TEXT("MeanSeconds"), totalSeconds / scenario.Seconds.Num());
+    report->SetNumberField(TEXT("FilesPerSecond"), bestSeconds > 0 ? corpus.Files.Num() / bestSeconds : 0.0);
+    report->SetNumberField(TEXT("MBPerSecond"), bestSeconds > 0 ? megabytes / bestSeconds : 0.0);
+
+    UE_LOG(LogPakFile, Display, TEXT("%s %s: %.3f seconds, %.0f files/s, %.2f MB/s%s"), *scenario.Container, *scenario.Name, bestSeconds,
+           bestSeconds > 0 ? corpus.Files.Num() / bestSeconds : 0.0, bestSeconds > 0 ? megabytes / bestSeconds : 0.0, scenario.bSuccess ? TEXT("") : TEXT(" (FAILED)"));
+    return report;
+}
+
+bool RunPakToolsBenchmark(const TCHAR *CmdLine) {
+    UE_LOG(LogPakFile, Display, TEXT("Using Unreal Engine %s"), *FEngineVersion::Current().ToString(EVersionComponent::Patch));
+
+    FBenchmarkSettings settings;
+    FParse::Value(CmdLine, TEXT("Files="), settings.NumFiles);
+    FParse::Value(CmdLine, TEXT("MinSizeKB="), settings.MinSizeKB);
+    FParse::Value(CmdLine, TEXT("MaxSizeKB="), settings.MaxSizeKB);
+    FParse::Value(CmdLine, TEXT("Compressibility="), settings.Compressibility);
+    FParse::Value(CmdLine, TEXT("Compression="), settings.CompressionMethod);
+    settings.bEncrypt = FParse::Param(CmdLine, TEXT("Encrypt"));
+    FParse::Value(CmdLine, TEXT("Iterations="), settings.Iterations);
+    FParse::Value(CmdLine, TEXT("Seed="), settings.Seed);
+
+    FString formats(TEXT("pak;utoc"));
+    FParse::Value(CmdLine, TEXT("Formats="), formats);
+    formats.ParseIntoArray(settings.Formats, TEXT(";"));
+
+    settings.WorkDir = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), TEXT("PakToolsBenchmark"));
+    if (FParse::Value(CmdLine, TEXT("WorkDir="), settings.WorkDir)) {
+        settings.WorkDir = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), settings.WorkDir);
+    }
+    settings.ReportFile = settings.WorkDir / TEXT("Report.json");
+    if (FParse::Value(CmdLine, TEXT("Report="), settings.ReportFile)) {
+        settings.ReportFile = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), settings.ReportFile);
+    }
+
+    // Extraction and verification take the same options as the command line tool, all cores are used by default
+    FExtractOptions extractOptions;
+    extractOptions.NumThreads = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+    if (!ParseExtractOptions(CmdLine, extractOptions)) {
+        return false;
+    }
+    FExtractOptions verifyOptions = extractOptions;
+    verifyOptions.bZeroCopy = false;
+    FListOptions listOptions;
+    FParse::Value(CmdLine, TEXT("Threads="), listOptions.NumThreads);
+
+    if (!PrepareWorkDir(settings.WorkDir)) {
+        return false;
+    }
+
+    TSharedRef<FJsonObject> phases = MakeShared<FJsonObject>();
+    auto timePhase = [&phases](const TCHAR *name, TFunctionRef<bool()> phase) {
+        const double startTime = FPlatformTime::Seconds();
+        const bool bSuccess = phase();
+        phases->SetNumberField(name, FPlatformTime::Seconds() - startTime);
+        return bSuccess;
+    };
+
+    FBenchmarkCorpus corpus;
+    if (!timePhase(TEXT("GenerateCorpus"), [&] { return GenerateCorpus(settings, corpus); })) {
+        return false;
+    }
+    UE_LOG(LogPakFile, Display, TEXT("Generated %d files, %.2f MB in '%s'"), corpus.Files.Num(), corpus.TotalSize / 1024.0 / 1024.0, *settings.WorkDir);
+
+    FKeyChain keyChain;
+    LoadKeyChain(*FString::Printf(TEXT("-cryptokeys=\"%s\""), *corpus.CryptoKeysFile), keyChain);
+    KeyChainUtilities::ApplyEncryptionKeys(keyChain);
+
+    TArray<FBenchmarkScenario> scenarios;
+    for (const FString &format : settings.Formats) {
+        const FString container = settings.WorkDir / TEXT("Benchmark.") + format;
+        const FString outputDir = settings.WorkDir / TEXT("Extract");
+
+        bool bCreated = false;
+        if (format == TEXT("pak")) {
+            bCreated = timePhase(TEXT("CreatePak"), [&] { return CreateBenchmarkPak(settings, corpus, container); });
+        } else if (format == TEXT("utoc")) {
+            bCreated = timePhase(TEXT("CreateIoStore"), [&] { return CreateBenchmarkIoStore(settings, corpus, keyChain, container); });
+        } else {
+            UE_LOG(LogPakFile, Error, TEXT("Unknown container format '%s', expected pak or utoc."), *format);
+        }
+        if (!bCreated) {
+            return false;
+        }
+
+        auto noPreparation = [] {};
+        auto deleteOutput = [&] { IFileManager::Get().DeleteDirectory(*outputDir, false, true); };
+        scenarios.Add(RunScenario(settings, format, TEXT("List"), noPreparation, [&] { return ListFilesInPak({container}, keyChain, listOptions); }));
+        scenarios.Add(RunScenario(settings, format, TEXT("Extract"), deleteOutput, [&] { return ExtractFilesFromPak(keyChain, {container}, outputDir, extractOptions); }));
+        scenarios.Add(RunScenario(settings, format, TEXT("Verify"), noPreparation, [&] { return VerifyFilesInPak({container}, keyChain, verifyOptions); }));
+        deleteOutput();
+    }
+
+    TSharedRef<FJsonObject> settingsReport = MakeShared<FJsonObject>();
+    settingsReport->SetNumberField(TEXT("Files"), settings.NumFiles);
+    settingsReport->SetNumberField(TEXT("MinSizeKB"), settings.MinSizeKB);
+    settingsReport->SetNumberField(TEXT("MaxSizeKB"), settings.MaxSizeKB);
+    settingsReport->SetNumberField(TEXT("Compressibility"), settings.Compressibility);
+    settingsReport->SetStringField(TEXT("Compression"), settings.CompressionMethod);
+    settingsReport->SetBoolField(TEXT("Encrypt"), settings.bEncrypt);
+    settingsReport->SetNumberField(TEXT("Iterations"), settings.Iterations);
+    settingsReport->SetNumberField(TEXT("Seed"), settings.Seed);
+    settingsReport->SetNumberField(TEXT("Threads"), extractOptions.NumThreads);
+    settingsReport->SetNumberField(TEXT("TotalSize"), corpus.TotalSize);
+
+    bool bSuccess = true;
+    TArray<TSharedPtr<FJsonValue>> scenarioReports;
+    for (const FBenchmarkScenario &scenario : scenarios) {
+        scenarioReports.Add(MakeShared<FJsonValueObject>(WriteScenarioReport(scenario, corpus)));
+        bSuccess &= scenario.bSuccess;
+    }
+
+    TSharedRef<FJsonObject> report = MakeShared<FJsonObject>();
+    report->SetStringField(TEXT("EngineVersion"), FEngineVersion::Current().ToString(EVersionComponent::Patch));
+    report->SetStringField(TEXT("Platform"), ANSI_TO_TCHAR(FPlatformProperties::IniPlatformName()));
+    report->SetNumberField(TEXT("Cores"), FPlatformMisc::NumberOfCoresIncludingHyperthreads());
+    report->SetObjectField(TEXT("Settings"), settingsReport);
+    report->SetObjectField(TEXT("Phases"), phases);
+    report->SetArrayField(TEXT("Scenarios"), scenarioReports);
+    report->SetNumberField(TEXT("PeakUsedPhysicalMB"), GetPeakUsedPhysicalMB());
+
+    FString json;
+    FJsonSerializer::Serialize(report, TJsonWriterFactory<>::Create(&json));
+    if (!FFileHelper::SaveStringToFile(json, *settings.ReportFile)) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to write the benchmark report '%s'."), *settings.ReportFile);
+        return false;
+    }
+    UE_LOG(LogPakFile, Display, TEXT("Benchmark report written to '%s'"), *settings.ReportFile);
+
+    return bSuccess;
+}
+} // namespace uetools
+
+#endif
@@ -0,0 +1,259 @@
+﻿#include "Algo/StableSort.h"
+#include "IPlatformFilePak.h"
+#include "PakTools.h"
+
+namespace uetools {
+constexpr uint64 GDiffStreamBudget = 64 * 1024 * 1024; // Decoded data in flight per hashed IoStore chunk
+
+struct FDiffEntry {
+    int64 UncompressedSize = 0;
+    const TCHAR *Source = nullptr;
+    FString Hash;
+    FName CompressionMethod;
+    bool bEncrypted = false;
+    int32 ContainerIndex = INDEX_NONE;
+};
+
+// Entries by path without the initial dots of the mount point, the same path as a pak and as an IoStore container
+using FDiffIndex = TMap<FString, FDiffEntry>;
+
+// Hashes what is serialized into it
+class FHashingArchive : public FArchive {
+  public:
+    FHashingArchive() { SetIsSaving(true); }
+
+    virtual void Serialize(void *V, int64 Length) override { Sha.Update(static_cast<const uint8 *>(V), Length); }
+    virtual FString GetArchiveName() const override { return TEXT("FHashingArchive"); }
+
+    FString GetHash() {
+        uint8 hash[FSHA1::DigestSize];
+        Sha.Final();
+        Sha.GetHash(hash);
+        return BytesToHex(hash, sizeof(hash));
+    }
+
+  private:
+    FSHA1 Sha;
+};
+
+// Each argument is a container, a directory of containers or a list of them separated by ';'
+TArray<FString> ExpandContainerSet(const FString &argument) {
+    TArray<FString> paths;
+    argument.ParseIntoArray(paths, TEXT(";"));
+
+    TArray<FString> containers;
+    for (const FString &path : paths) {
+        const FString fullPath = GetContainerPath(path);
+        if (!IFileManager::Get().DirectoryExists(*fullPath)) {
+            containers.Add(fullPath);
+            continue;
+        }
+
+        TArray<FString> directoryContainers;
+        IFileManager::Get().FindFiles(directoryContainers, *(fullPath / TEXT("*.pak")), true, false);
+        IFileManager::Get().FindFiles(directoryContainers, *(fullPath / TEXT("*.utoc")), true, false);
+        directoryContainers.Sort();
+        for (const FString &container : directoryContainers) {
+            containers.Add(fullPath / container);
+        }
+    }
+    return containers;
+}
+
+// Pak hashes are taken on the stored data and IoStore hashes on the decompressed data, only hashes of the same kind can be compared. Pak entries must also be
+// stored the same way, the same content recompressed or encrypted with another setting has another hash.
+bool HasComparableHashes(const FDiffEntry &oldEntry, const FDiffEntry &newEntry) {
+    auto isAvailable = [](const FString &hash) {
+        for (const TCHAR character : hash) {
+            if (character != TEXT('0')) {
+                return true;
+            }
+        }
+        return false;
+    };
+    return FCString::Strcmp(oldEntry.Source, newEntry.Source) == 0 && isAvailable(oldEntry.Hash) && isAvailable(newEntry.Hash) &&
+           oldEntry.CompressionMethod == newEntry.CompressionMethod && oldEntry.bEncrypted == newEntry.bEncrypted;
+}
+
+// SHA1 of the decoded content of the given paths, used when the stored hashes cannot be compared
+bool HashContainerContents(const FString &containerPath, const FKeyChain &keyChain, const TArray<FString> &paths, TMap<FString, FString> &outHashes) {
+    if (FPaths::GetExtension(containerPath) == TEXT("pak")) {
+        const auto pak = OpenPakFile(containerPath, keyChain);
+        if (!pak) {
+            return false;
+        }
+
+        // Paths outside the mount point cannot be in the pak
+        const FString mountPrefix = GetFileWithoutInitialDots(pak->GetMountPoint());
+        FExtractOptions options;
+        for (const FString &path : paths) {
+            FString pakPath;
+            if (GetPathUnderMountPrefix(mountPrefix, path, pakPath)) {
+                options.FileList.Add(path);
+            }
+        }
+
+        TArray<FPakExtractItem> items;
+        CollectPakItems(*pak, options, items);
+
+        FPakExtractWorker worker;
+        worker.Buffer = FMemory::Malloc(GCopyBufferSize);
+        FSharedPakReader pakReader = pak->GetSharedReader(nullptr);
+        for (const FPakExtractItem &item : items) {
+            FPakEntry EntryInfo;
+            FHashingArchive hasher;
+            if (ReadPakEntryHeader(*pak, pakReader.GetArchive(), item, EntryInfo) && DecodePakEntry(hasher, pakReader.GetArchive(), *pak, item, worker, keyChain, options)) {
+                outHashes.Add(item.Filename, hasher.GetHash());
+            }
+        }
+        FMemory::Free(worker.Buffer);
+        FMemory::Free(worker.CompressionBuffer);
+        return true;
+    }
+
+    auto ioStoreReader = CreateIoStoreReader(containerPath, keyChain);
+    if (!ioStoreReader) {
+        return false;
+    }
+
+    FExtractOptions options;
+    options.FileList = paths;
+    TArray<FIoStoreExtractItem> items;
+    CollectIoStoreItems(*ioStoreReader, options, items);
+    for (const FIoStoreExtractItem &item : items) {
+        FHashingArchive hasher;
+        if (StreamIoStoreChunk(*ioStoreReader, item, GDiffStreamBudget, hasher)) {
+            outHashes.Add(item.Filename, hasher.GetHash());
+        }
+    }
+    return true;
+}
+
+bool DiffContainers(const FString &oldContainers, const FString &newContainers, const FKeyChain &keyChain, int32 numThreads) {
+    // Each side is mounted as by ResolveOverlay: by patch level, then in the order of the command line
+    const auto byPatchLevel = [](const FString &path) { return GetPatchLevel(path); };
+    TArray<FString> oldContainerPaths = ExpandContainerSet(oldContainers);
+    TArray<FString> newContainerPaths = ExpandContainerSet(newContainers);
+    Algo::StableSortBy(oldContainerPaths, byPatchLevel);
+    Algo::StableSortBy(newContainerPaths, byPatchLevel);
+    TArray<FString> containerPaths = oldContainerPaths;
+    containerPaths.Append(newContainerPaths);
+    const int32 numOldContainers = oldContainerPaths.Num();
+
+    // Only the indexes are read, every container in parallel
+    TArray<TOptional<TArray<FToolFileEntry>>> filesByContainer;
+    filesByContainer.SetNum(containerPaths.Num());
+    ParallelForThreads(containerPaths.Num(), numThreads, [&](int32 containerIndex) {
+        const FString &containerPath = containerPaths[containerIndex];
+        const FString extension = FPaths::GetExtension(containerPath);
+        if (extension == TEXT("pak")) {
+            filesByContainer[containerIndex] = ReadFileListFromPak(containerPath, keyChain);
+        } else if (extension == TEXT("utoc")) {
+            filesByContainer[containerIndex] = ReadFileListFromToc(containerPath, keyChain);
+        } else {
+            UE_LOG(LogPakFile, Error, TEXT("Expected .pak or .utoc file but got '%s'"), *containerPath);
+        }
+    });
+
+    // Later containers take precedence when they contain the same path, and their delete records remove it from the earlier ones
+    FDiffIndex oldIndex;
+    FDiffIndex newIndex;
+    for (int32 containerIndex = 0; containerIndex < containerPaths.Num(); containerIndex++) {
+        if (!filesByContainer[containerIndex].IsSet()) {
+            UE_LOG(LogPakFile, Error, TEXT("Unable to read the index of '%s'."), *containerPaths[containerIndex]);
+            return false;
+        }
+        FDiffIndex &index = containerIndex < numOldContainers ? oldIndex : newIndex;
+        for (const FToolFileEntry &entry : filesByContainer[containerIndex].GetValue()) {
+            if (entry.bDeleteRecord) {
+                index.Remove(GetFileWithoutInitialDots(entry.Filename));
+            }
+        }
+        for (FToolFileEntry &entry : filesByContainer[containerIndex].GetValue()) {
+            if (!entry.bDeleteRecord) {
+                index.Add(GetFileWithoutInitialDots(entry.Filename),
+                          {entry.UncompressedSize, entry.Source, MoveTemp(entry.Hash), entry.CompressionMethod, entry.bEncrypted, containerIndex});
+            }
+        }
+    }
+    filesByContainer.Empty();
+
+    TArray<FString> added;
+    TArray<FString> removed;
+    TArray<FString> modified;
+    TArray<FString> sameSize;
+    int64 byteDelta = 0;
+    for (const auto &KV : newIndex) {
+        const FDiffEntry *oldEntry = oldIndex.Find(KV.Key);
+        if (oldEntry == nullptr) {
+            added.Add(KV.Key);
+            byteDelta += KV.Value.UncompressedSize;
+        } else if (oldEntry->UncompressedSize != KV.Value.UncompressedSize) {
+            modified.Add(KV.Key);
+            byteDelta += KV.Value.UncompressedSize - oldEntry->UncompressedSize;
+        } else if (!HasComparableHashes(*oldEntry, KV.Value)) {
+            sameSize.Add(KV.Key);
+        } else if (oldEntry->Hash != KV.Value.Hash) {
+            modified.Add(KV.Key);
+        }
+    }
+    for (const auto &KV : oldIndex) {
+        if (!newIndex.Contains(KV.Key)) {
+            removed.Add(KV.Key);
+            byteDelta -= KV.Value.UncompressedSize;
+        }
+    }
+
+    // Payload is only read for the entries of the same size without comparable hashes
+    int32 unverifiedFiles = 0;
+    if (sameSize.Num() > 0) {
+        UE_LOG(LogPakFile, Display, TEXT("Hashing the content of %d files without comparable stored hashes"), sameSize.Num());
+
+        TArray<TArray<FString>> pathsByContainer;
+        pathsByContainer.SetNum(containerPaths.Num());
+        for (const FString &path : sameSize) {
+            pathsByContainer[oldIndex[path].ContainerIndex].Add(path);
+            pathsByContainer[newIndex[path].ContainerIndex].Add(path);
+        }
+
+        TArray<TMap<FString, FString>> hashesByContainer;
+        hashesByContainer.SetNum(containerPaths.Num());
+        ParallelForThreads(containerPaths.Num(), numThreads, [&](int32 containerIndex) {
+            if (pathsByContainer[containerIndex].Num() > 0) {
+                HashContainerContents(containerPaths[containerIndex], keyChain, pathsByContainer[containerIndex], hashesByContainer[containerIndex]);
+            }
+        });
+
+        for (const FString &path : sameSize) {
+            const FString *oldHash = hashesByContainer[oldIndex[path].ContainerIndex].Find(path);
+            const FString *newHash = hashesByContainer[newIndex[path].ContainerIndex].Find(path);
+            if (oldHash == nullptr || newHash == nullptr) {
+                unverifiedFiles++;
+            } else if (*oldHash != *newHash) {
+                modified.Add(path);
+            }
+        }
+    }
+
+    added.Sort();
+    removed.Sort();
+    modified.Sort();
+    for (const FString &path : added) {
+        UE_LOG(LogPakFile, Display, TEXT("Added: %s (%s)"), *path, *HumanSize(newIndex[path].UncompressedSize));
+    }
+    for (const FString &path : removed) {
+        UE_LOG(LogPakFile, Display, TEXT("Removed: %s (%s)"), *path, *HumanSize(oldIndex[path].UncompressedSize));
+    }
+    for (const FString &path : modified) {
+        UE_LOG(LogPakFile, Display, TEXT("Modified: %s (%s -> %s)"), *path, *HumanSize(oldIndex[path].UncompressedSize), *HumanSize(newIndex[path].UncompressedSize));
+    }
+
+    if (unverifiedFiles > 0) {
+        UE_LOG(LogPakFile, Warning, TEXT("%d files of the same size could not be hashed and are assumed unchanged."), unverifiedFiles);
+    }
+    UE_LOG(LogPakFile, Display, TEXT("%d added, %d removed, %d modified, %d unchanged. Byte delta: %s%s"), added.Num(), removed.Num(), modified.Num(),
+           newIndex.Num() - added.Num() - modified.Num(), byteDelta < 0 ? TEXT("-") : TEXT("+"), *HumanSize(FMath::Abs(byteDelta)));
+
+    return true;
+}
+} // namespace uetools
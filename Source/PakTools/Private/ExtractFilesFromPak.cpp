@@ -1,10 +1,30 @@
-﻿#include "IPlatformFilePak.h"
+﻿#include "Algo/Sort.h"
+#include "Algo/SortBy.h"
+#include "Algo/StableSort.h"
+#include "Async/ParallelFor.h"
+#include "Containers/Queue.h"
+#include "ExtractStats.h"
+#include "IPlatformFilePak.h"
 #include "KeyChainUtilities.h"
+#include "Misc/ScopeExit.h"
 #include "PakTools.h"
+#include "TarWriter.h"
+#include "Tasks/Task.h"
+#include "WriteBehindQueue.h"
+
+#include <atomic>
+
+#if PLATFORM_LINUX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace uetools {
 
-inline bool BufferedCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry &Entry, void *Buffer, int64 BufferSize, const FKeyChain &InKeyChain) {
+bool BufferedCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry &Entry, void *Buffer, int64 BufferSize, const FKeyChain &InKeyChain, FPakEntryHasher *Hasher) {
     // Align down
     BufferSize = BufferSize & ~(FAES::AESBlockSize - 1);
     int64 RemainingSizeToCopy = Entry.Size;
@@ -13,20 +33,30 @@ inline bool BufferedCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry &
         // If file is encrypted so we need to account for padding
         int64 SizeToRead = Entry.IsEncrypted() ? Align(SizeToCopy, FAES::AESBlockSize) : SizeToCopy;
 
-        Source.Serialize(Buffer, SizeToRead);
+        {
+            PAKTOOLS_STAGE_SCOPE(Read, SizeToRead);
+            Source.Serialize(Buffer, SizeToRead);
+        }
+        if (Hasher) {
+            Hasher->Update((const uint8 *)Buffer, SizeToRead);
+        }
         if (Entry.IsEncrypted()) {
+            PAKTOOLS_STAGE_SCOPE(Decrypt, SizeToRead);
             const FNamedAESKey *Key = InKeyChain.GetPrincipalEncryptionKey();
             check(Key);
             FAES::DecryptData((uint8 *)Buffer, SizeToRead, Key->Key);
         }
-        Dest.Serialize(Buffer, SizeToCopy);
+        {
+            PAKTOOLS_STAGE_SCOPE(Write, SizeToCopy);
+            Dest.Serialize(Buffer, SizeToCopy);
+        }
         RemainingSizeToCopy -= SizeToRead;
     }
     return true;
 }
 
-inline bool UncompressCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry &Entry, uint8 *&PersistentBuffer, int64 &BufferSize, const FKeyChain &InKeyChain,
-                               const FPakFile &PakFile) {
+bool UncompressCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry &Entry, uint8 *&PersistentBuffer, int64 &BufferSize, const FKeyChain &InKeyChain,
+                        const FPakFile &PakFile, FPakEntryHasher *Hasher) {
     if (Entry.UncompressedSize == 0) {
         return false;
     }
@@ -51,11 +81,18 @@ inline bool UncompressCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry
     for (uint32 BlockIndex = 0, BlockIndexNum = Entry.CompressionBlocks.Num(); BlockIndex < BlockIndexNum; ++BlockIndex) {
         int64 CompressedBlockSize = Entry.CompressionBlocks[BlockIndex].CompressedEnd - Entry.CompressionBlocks[BlockIndex].CompressedStart;
         int64 UncompressedBlockSize = FMath::Min<int64>(Entry.UncompressedSize - Entry.CompressionBlockSize * BlockIndex, Entry.CompressionBlockSize);
-        Source.Seek(Entry.CompressionBlocks[BlockIndex].CompressedStart + (PakFile.GetInfo().HasRelativeCompressedChunkOffsets() ? Entry.Offset : 0));
         int64 SizeToRead = Entry.IsEncrypted() ? Align(CompressedBlockSize, FAES::AESBlockSize) : CompressedBlockSize;
-        Source.Serialize(PersistentBuffer, SizeToRead);
+        {
+            PAKTOOLS_STAGE_SCOPE(Read, SizeToRead);
+            Source.Seek(Entry.CompressionBlocks[BlockIndex].CompressedStart + (PakFile.GetInfo().HasRelativeCompressedChunkOffsets() ? Entry.Offset : 0));
+            Source.Serialize(PersistentBuffer, SizeToRead);
+        }
+        if (Hasher) {
+            Hasher->Update(PersistentBuffer, SizeToRead);
+        }
 
         if (Entry.IsEncrypted()) {
+            PAKTOOLS_STAGE_SCOPE(Decrypt, SizeToRead);
             const FNamedAESKey *Key = InKeyChain.GetEncryptionKeys().Find(PakFile.GetInfo().EncryptionKeyGuid);
             if (Key == nullptr) {
                 Key = InKeyChain.GetPrincipalEncryptionKey();
@@ -64,137 +101,1308 @@ inline bool UncompressCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry
             FAES::DecryptData(PersistentBuffer, SizeToRead, Key->Key);
         }
 
-        if (!FCompression::UncompressMemory(EntryCompressionMethod, UncompressedBuffer, IntCastChecked<int32>(UncompressedBlockSize), PersistentBuffer,
-                                            IntCastChecked<int32>(CompressedBlockSize))) {
-            return false;
+        {
+            PAKTOOLS_STAGE_SCOPE(Decompress, UncompressedBlockSize);
+            if (!FCompression::UncompressMemory(EntryCompressionMethod, UncompressedBuffer, IntCastChecked<int32>(UncompressedBlockSize), PersistentBuffer,
+                                                IntCastChecked<int32>(CompressedBlockSize))) {
+                return false;
+            }
+        }
+        {
+            PAKTOOLS_STAGE_SCOPE(Write, UncompressedBlockSize);
+            Dest.Serialize(UncompressedBuffer, UncompressedBlockSize);
         }
-        Dest.Serialize(UncompressedBuffer, UncompressedBlockSize);
     }
 
     return true;
 }
 
-bool ExtractFilesFromPak(const FKeyChain &keyChain, const FString &pakFile, const FString &outputDir) {
-    const FString absolutePakFile = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), pakFile);
-    const FString absoluteOutputDir = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), outputDir);
+// Decrypts and decompresses blocks in parallel, WindowSize blocks at a time. The next window is read while the current one is decoded, then the blocks are
+// written back in order, so at most 2 * WindowSize blocks are kept in memory.
+bool PipelinedUncompressCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry &Entry, const FKeyChain &InKeyChain, const FPakFile &PakFile, int32 WindowSize,
+                                 FPakEntryHasher *Hasher) {
+    if (Entry.UncompressedSize == 0) {
+        return false;
+    }
 
-    UE_LOG(LogPakFile, Display, TEXT("Extracting files from %s"), *absolutePakFile);
-    UE_LOG(LogPakFile, Display, TEXT("Output directory: %s"), *absoluteOutputDir);
+    struct FBlockSlot {
+        TArray64<uint8> CompressedData;
+        TArray64<uint8> UncompressedData;
+        int64 CompressedSize = 0;
+        int64 UncompressedSize = 0;
+        bool bSuccess = false;
+    };
 
-    constexpr int64 bufferSize = 8 * 1024 * 1024; // 8MB buffer for extracting
-    void *Buffer = FMemory::Malloc(bufferSize);
+    FName EntryCompressionMethod = PakFile.GetInfo().GetCompressionMethod(Entry.CompressionMethodIndex);
+    int32 MaxCompressionBlockSize = FCompression::CompressMemoryBound(EntryCompressionMethod, Entry.CompressionBlockSize);
+    for (const FPakCompressedBlock &Block : Entry.CompressionBlocks) {
+        MaxCompressionBlockSize = FMath::Max<int32>(MaxCompressionBlockSize, IntCastChecked<int32>(Block.CompressedEnd - Block.CompressedStart));
+    }
 
-    int32 fileErrors = 0;
+    const FNamedAESKey *Key = nullptr;
+    if (Entry.IsEncrypted()) {
+        Key = InKeyChain.GetEncryptionKeys().Find(PakFile.GetInfo().EncryptionKeyGuid);
+        if (Key == nullptr) {
+            Key = InKeyChain.GetPrincipalEncryptionKey();
+        }
+        check(Key);
+    }
+
+    const int32 BlockIndexNum = Entry.CompressionBlocks.Num();
+    WindowSize = FMath::Clamp(WindowSize, 1, BlockIndexNum);
+
+    // Two sets of slots: one being decoded, the other one being read
+    TArray<FBlockSlot> Slots;
+    Slots.SetNum(WindowSize * 2);
+    for (FBlockSlot &Slot : Slots) {
+        Slot.CompressedData.SetNumUninitialized(Align(MaxCompressionBlockSize, FAES::AESBlockSize));
+        Slot.UncompressedData.SetNumUninitialized(Entry.CompressionBlockSize);
+    }
+
+    auto ReadWindow = [&](int32 FirstBlock, FBlockSlot *WindowSlots) {
+        for (int32 BlockIndex = FirstBlock, SlotIndex = 0; BlockIndex < BlockIndexNum && SlotIndex < WindowSize; ++BlockIndex, ++SlotIndex) {
+            FBlockSlot &Slot = WindowSlots[SlotIndex];
+            Slot.CompressedSize = Entry.CompressionBlocks[BlockIndex].CompressedEnd - Entry.CompressionBlocks[BlockIndex].CompressedStart;
+            Slot.UncompressedSize = FMath::Min<int64>(Entry.UncompressedSize - Entry.CompressionBlockSize * BlockIndex, Entry.CompressionBlockSize);
+            const int64 SizeToRead = Entry.IsEncrypted() ? Align(Slot.CompressedSize, FAES::AESBlockSize) : Slot.CompressedSize;
+            {
+                PAKTOOLS_STAGE_SCOPE(Read, SizeToRead);
+                Source.Seek(Entry.CompressionBlocks[BlockIndex].CompressedStart + (PakFile.GetInfo().HasRelativeCompressedChunkOffsets() ? Entry.Offset : 0));
+                Source.Serialize(Slot.CompressedData.GetData(), SizeToRead);
+            }
+            if (Hasher) {
+                Hasher->Update(Slot.CompressedData.GetData(), SizeToRead);
+            }
+        }
+    };
+
+    ReadWindow(0, Slots.GetData());
+
+    for (int32 FirstBlock = 0, WindowIndex = 0; FirstBlock < BlockIndexNum; FirstBlock += WindowSize, ++WindowIndex) {
+        FBlockSlot *CurrentSlots = Slots.GetData() + (WindowIndex % 2) * WindowSize;
+        FBlockSlot *NextSlots = Slots.GetData() + ((WindowIndex + 1) % 2) * WindowSize;
+        const int32 NumBlocks = FMath::Min(WindowSize, BlockIndexNum - FirstBlock);
+
+        TArray<UE::Tasks::FTask> DecodeTasks;
+        DecodeTasks.Reserve(NumBlocks);
+        for (int32 SlotIndex = 0; SlotIndex < NumBlocks; ++SlotIndex) {
+            FBlockSlot &Slot = CurrentSlots[SlotIndex];
+            DecodeTasks.Add(UE::Tasks::Launch(UE_SOURCE_LOCATION, [&Slot, &Entry, Key, EntryCompressionMethod] {
+                if (Key != nullptr) {
+                    PAKTOOLS_STAGE_SCOPE(Decrypt, Align(Slot.CompressedSize, FAES::AESBlockSize));
+                    FAES::DecryptData(Slot.CompressedData.GetData(), Align(Slot.CompressedSize, FAES::AESBlockSize), Key->Key);
+                }
+                PAKTOOLS_STAGE_SCOPE(Decompress, Slot.UncompressedSize);
+                Slot.bSuccess = FCompression::UncompressMemory(EntryCompressionMethod, Slot.UncompressedData.GetData(), IntCastChecked<int32>(Slot.UncompressedSize),
+                                                               Slot.CompressedData.GetData(), IntCastChecked<int32>(Slot.CompressedSize));
+            }));
+        }
+
+        // Read ahead while the current window is being decoded
+        if (FirstBlock + WindowSize < BlockIndexNum) {
+            ReadWindow(FirstBlock + WindowSize, NextSlots);
+        }
+
+        UE::Tasks::Wait(DecodeTasks);
+
+        for (int32 SlotIndex = 0; SlotIndex < NumBlocks; ++SlotIndex) {
+            FBlockSlot &Slot = CurrentSlots[SlotIndex];
+            if (!Slot.bSuccess) {
+                return false;
+            }
+            PAKTOOLS_STAGE_SCOPE(Write, Slot.UncompressedSize);
+            Dest.Serialize(Slot.UncompressedData.GetData(), Slot.UncompressedSize);
+        }
+    }
+
+    return true;
+}
+
+constexpr int64 GMaxRunSize = 16 * 1024 * 1024; // Adjacent pak entries are merged into reads up to this size
+constexpr int64 GMaxRunGap = 64 * 1024;         // Gaps smaller than this are read through instead of seeking
+
+// Group of pak entries stored next to each other, fetched with a single read
+struct FPakExtractRun {
+    int32 FirstItem = 0;
+    int32 NumItems = 0;
+    int64 Offset = 0;
+    int64 Size = 0;
+};
+
+// Serves a run from memory, offsets are absolute positions in the pak file so the copy functions can be used unchanged
+class FPakRunReader : public FArchive {
+  public:
+    FPakRunReader(const uint8 *InData, int64 InOffset, int64 InSize)
+        : Data(InData)
+        , Offset(InOffset)
+        , Size(InSize) {
+        SetIsLoading(true);
+    }
+
+    virtual void Serialize(void *V, int64 Length) override {
+        if (Pos < 0 || Pos + Length > Size) {
+            SetError();
+            FMemory::Memzero(V, Length);
+            return;
+        }
+        FMemory::Memcpy(V, Data + Pos, Length);
+        Pos += Length;
+    }
+
+    virtual void Seek(int64 InPos) override { Pos = InPos - Offset; }
+    virtual int64 Tell() override { return Offset + Pos; }
+    virtual int64 TotalSize() override { return Offset + Size; }
+    virtual FString GetArchiveName() const override { return TEXT("FPakRunReader"); }
+
+  private:
+    const uint8 *Data;
+    int64 Offset;
+    int64 Size;
+    int64 Pos = 0;
+};
+
+// Size of the entry in the pak file, including its header and the encryption padding
+int64 GetPakEntryDiskSize(const FPakEntry &entry, int32 pakVersion) {
+    return entry.GetSerializedSize(pakVersion) + (entry.IsEncrypted() ? Align(entry.Size, FAES::AESBlockSize) : entry.Size);
+}
+
+// Splits the work list into runs. When sorting by offset, entries are processed in their physical order and neighbours are merged into larger reads.
+// Returns the number of entries that start where the previous one ended (or close enough to be read through).
+int32 PlanPakExtraction(TArray<FPakExtractItem> &items, int32 pakVersion, bool bSortByOffset, TArray<FPakExtractRun> &outRuns) {
+    if (bSortByOffset) {
+        Algo::SortBy(items, [](const FPakExtractItem &item) { return item.Entry.Offset; });
+    }
+
+    int32 sequentialItems = 0;
+    int64 previousEnd = -1;
+    for (int32 itemIndex = 0; itemIndex < items.Num(); itemIndex++) {
+        const FPakEntry &entry = items[itemIndex].Entry;
+        const int64 entrySize = GetPakEntryDiskSize(entry, pakVersion);
+
+        const bool bSequential = previousEnd >= 0 && entry.Offset >= previousEnd && entry.Offset - previousEnd <= GMaxRunGap;
+        if (bSequential) {
+            sequentialItems++;
+        }
+
+        FPakExtractRun *lastRun = outRuns.Num() > 0 ? &outRuns.Last() : nullptr;
+        if (bSortByOffset && bSequential && lastRun && entry.Offset + entrySize - lastRun->Offset <= GMaxRunSize) {
+            lastRun->NumItems++;
+            lastRun->Size = entry.Offset + entrySize - lastRun->Offset;
+        } else {
+            outRuns.Add({itemIndex, 1, entry.Offset, entrySize});
+        }
+        previousEnd = entry.Offset + entrySize;
+    }
 
-    uint8 *persistantCompressionBuffer = nullptr;
-    int64 compressionBufferSize = 0;
+    return sequentialItems;
+}
 
-    if (!FPaths::FileExists(absolutePakFile)) {
-        UE_LOG(LogPakFile, Error, TEXT("Pak file '%s' does not exist."), *absolutePakFile);
+#if PLATFORM_LINUX
+// Copies a range of the pak straight into a new file with copy_file_range (or sendfile), so the payload never goes through userspace.
+// Returns false if the kernel rejects both calls, the caller is expected to rewrite the file with the buffered path.
+bool ZeroCopyFile(int32 pakFileDescriptor, int64 offset, int64 size, const FString &destFilename, FWriteBehindQueue *writeBehind) {
+    if (writeBehind) {
+        writeBehind->MakeParentDirectory(destFilename);
+    } else {
+        IFileManager::Get().MakeDirectory(*FPaths::GetPath(destFilename), true);
+    }
+    UnlinkOutputFile(destFilename);
+    const int32 outputFileDescriptor = open(TCHAR_TO_UTF8(*destFilename), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (outputFileDescriptor < 0) {
         return false;
     }
 
-    const FString extension = FPaths::GetExtension(absolutePakFile);
-    if (extension == TEXT("pak")) {
-        const auto pak = OpenPakFile(absolutePakFile, keyChain);
-        if (!pak) {
-            return false;
+    int64 inputOffset = offset;
+    int64 remainingSize = size;
+#ifdef SYS_copy_file_range
+    bool bUseSendFile = false;
+#else
+    bool bUseSendFile = true;
+#endif
+    while (remainingSize > 0) {
+        ssize_t copiedSize = -1;
+        if (!bUseSendFile) {
+#ifdef SYS_copy_file_range
+            copiedSize = syscall(SYS_copy_file_range, pakFileDescriptor, &inputOffset, outputFileDescriptor, nullptr, size_t(remainingSize), 0u);
+#endif
+            if (copiedSize < 0 && errno != EINTR) {
+                // Not supported by the kernel or across these filesystems, sendfile continues from the same position
+                bUseSendFile = true;
+                continue;
+            }
+        } else {
+            off_t sendFileOffset = inputOffset;
+            copiedSize = sendfile(outputFileDescriptor, pakFileDescriptor, &sendFileOffset, size_t(remainingSize));
+            inputOffset = sendFileOffset;
         }
 
-        UE_LOG(LogPakFile, Display, TEXT("Mount Point: %s"), *pak->GetMountPoint());
+        if (copiedSize < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copiedSize <= 0) {
+            break;
+        }
+        remainingSize -= copiedSize;
+    }
 
-        if (!pak->HasFilenames()) {
-            UE_LOG(LogPakFile, Error, TEXT("PakFiles were loaded without filenames, cannot extract."));
+    close(outputFileDescriptor);
+    return remainingSize == 0;
+}
+#endif
+
+// Decodes an entry into a buffer allocated to its final size, so it can be handed to the write-behind queue without a copy
+class FIoBufferWriter : public FArchive {
+  public:
+    explicit FIoBufferWriter(FIoBuffer &InBuffer)
+        : Buffer(InBuffer) {
+        SetIsSaving(true);
+    }
+
+    virtual void Serialize(void *V, int64 Length) override {
+        if (Pos + Length > int64(Buffer.DataSize())) {
+            SetError();
+            return;
+        }
+        FMemory::Memcpy(Buffer.GetData() + Pos, V, Length);
+        Pos += Length;
+    }
+
+    virtual int64 Tell() override { return Pos; }
+    virtual int64 TotalSize() override { return int64(Buffer.DataSize()); }
+    virtual FString GetArchiveName() const override { return TEXT("FIoBufferWriter"); }
+
+  private:
+    FIoBuffer &Buffer;
+    int64 Pos = 0;
+};
+
+// Reads the payload of the entry from pakReader (positioned after the entry header) and writes its decoded content to dest
+bool DecodePakEntry(FArchive &dest, FArchive &pakReader, const FPakFile &pak, const FPakExtractItem &item, FPakExtractWorker &worker, const FKeyChain &keyChain,
+                    const FExtractOptions &options, FPakEntryHasher *hasher) {
+    if (item.Entry.CompressionMethodIndex == 0) {
+        return BufferedCopyFile(dest, pakReader, item.Entry, worker.Buffer, GCopyBufferSize, keyChain, hasher);
+    }
+    if (options.BlockWindow > 0 && item.Entry.CompressionBlocks.Num() >= GPipelinedBlockThreshold) {
+        return PipelinedUncompressCopyFile(dest, pakReader, item.Entry, keyChain, pak, options.BlockWindow, hasher);
+    }
+    return UncompressCopyFile(dest, pakReader, item.Entry, worker.CompressionBuffer, worker.CompressionBufferSize, keyChain, pak, hasher);
+}
+
+// Reads the header stored in front of the payload and checks it against the index, pakReader is then positioned on the payload
+bool ReadPakEntryHeader(const FPakFile &pak, FArchive &pakReader, const FPakExtractItem &item, FPakEntry &outEntryInfo) {
+    pakReader.Seek(item.Entry.Offset);
+    outEntryInfo.Serialize(pakReader, pak.GetInfo().Version);
+    if (!outEntryInfo.IndexDataEquals(item.Entry)) {
+        UE_LOG(LogPakFile, Error, TEXT("PakEntry mismatch for \"%s\"."), *item.Filename);
+        return false;
+    }
+    return true;
+}
+
+bool ExtractPakEntry(const FPakFile &pak, FArchive &pakReader, bool bFromPakFile, const FPakExtractItem &item, const FString &outputDir, FPakExtractWorker &worker,
+                     const FKeyChain &keyChain, const FExtractOptions &options, FWriteBehindQueue *writeBehind) {
+    FString destFilename(outputDir / item.Filename);
+
+    UE_LOG(LogPakFile, Display, TEXT("Extracting '%s'"), *destFilename);
+    FExtractEntryScope entryScope(item.Filename, pak.GetInfo().GetCompressionMethod(item.Entry.CompressionMethodIndex), item.Entry.Size, item.Entry.UncompressedSize);
+
+    FPakEntry EntryInfo;
+    if (!ReadPakEntryHeader(pak, pakReader, item, EntryInfo)) {
+        return false;
+    }
+
+#if PLATFORM_LINUX
+    // Stored entries can be copied by the kernel directly from the pak file
+    if (bFromPakFile && worker.PakFileDescriptor >= 0 && item.Entry.CompressionMethodIndex == 0 && !item.Entry.IsEncrypted()) {
+        const int64 payloadOffset = item.Entry.Offset + EntryInfo.GetSerializedSize(pak.GetInfo().Version);
+        PAKTOOLS_STAGE_SCOPE(Write, item.Entry.Size);
+        if (ZeroCopyFile(worker.PakFileDescriptor, payloadOffset, item.Entry.Size, destFilename, writeBehind)) {
+            worker.ZeroCopyFiles++;
+            worker.ExtractedBytes += item.Entry.UncompressedSize;
+            return true;
+        }
+    }
+#endif
+
+    // Small files are decoded in memory and written by the write-behind threads
+    if (writeBehind && item.Entry.UncompressedSize <= GMaxWriteBehindFileSize) {
+        FIoBuffer data(item.Entry.UncompressedSize);
+        FIoBufferWriter dataWriter(data);
+        if (!DecodePakEntry(dataWriter, pakReader, pak, item, worker, keyChain, options) || dataWriter.IsError()) {
             return false;
         }
+        writeBehind->Enqueue(MoveTemp(destFilename), MoveTemp(data));
+        worker.ExtractedBytes += item.Entry.UncompressedSize;
+        return true;
+    }
+
+    TUniquePtr<FArchive> FileHandle;
+    {
+        PAKTOOLS_STAGE_SCOPE(Create, item.Entry.UncompressedSize);
+        FileHandle.Reset(writeBehind ? writeBehind->CreatePreallocatedWriter(destFilename, item.Entry.UncompressedSize)
+                                     : CreateOutputFileWriter(destFilename));
+    }
+    if (!FileHandle) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to create file \"%s\"."), *destFilename);
+        return false;
+    }
+
+    bool bWritten = DecodePakEntry(*FileHandle, pakReader, pak, item, worker, keyChain, options);
+    {
+        PAKTOOLS_STAGE_SCOPE(Write, 0);
+        bWritten &= FileHandle->Close();
+    }
+    if (!bWritten) {
+        // A preallocated file keeps its final size with a zero-filled tail, it must not look complete to the next incremental run
+        FileHandle.Reset();
+        UnlinkOutputFile(destFilename);
+        return false;
+    }
+
+    worker.ExtractedBytes += item.Entry.UncompressedSize;
+    return true;
+}
+
+// Streams an entry into the archive, its size is known from the index so the decoded data goes straight through without being buffered
+bool ExtractPakEntryToTar(const FPakFile &pak, FArchive &pakReader, const FPakExtractItem &item, FPakExtractWorker &worker, const FKeyChain &keyChain,
+                          const FExtractOptions &options, FTarWriter &tarWriter) {
+    UE_LOG(LogPakFile, Display, TEXT("Extracting '%s'"), *item.Filename);
+    FExtractEntryScope entryScope(item.Filename, pak.GetInfo().GetCompressionMethod(item.Entry.CompressionMethodIndex), item.Entry.Size, item.Entry.UncompressedSize);
+
+    FPakEntry EntryInfo;
+    if (!ReadPakEntryHeader(pak, pakReader, item, EntryInfo) || !tarWriter.BeginFile(item.Filename, item.Entry.UncompressedSize)) {
+        return false;
+    }
+
+    const bool bDecoded = DecodePakEntry(tarWriter, pakReader, pak, item, worker, keyChain, options);
+    if (!tarWriter.EndFile() || !bDecoded) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to stream \"%s\" to the archive."), *item.Filename);
+        return false;
+    }
+
+    worker.ExtractedBytes += item.Entry.UncompressedSize;
+    return true;
+}
+
+// Plans the reads, then lets the workers pull runs and hand each entry to the processor with a reader positioned anywhere in the pak
+void ProcessPakItems(const FPakFile &pak, TArray<FPakExtractItem> &items, const FExtractOptions &options, TArray<FPakExtractWorker> &workers, TArray<bool> &outSucceeded,
+                     FPakEntryProcessor processor) {
+    const int32 numWorkers = workers.Num();
+    TArray<FPakExtractRun> runs;
+    const int32 sequentialItems = PlanPakExtraction(items, pak.GetInfo().Version, options.bSortByOffset, runs);
+    outSucceeded.Reset();
+    outSucceeded.SetNumZeroed(items.Num());
+
+    std::atomic<int32> nextRun{0};
+    ParallelFor(
+        numWorkers,
+        [&](int32 workerIndex) {
+            FPakExtractWorker &worker = workers[workerIndex];
+            worker.Buffer = FMemory::Malloc(GCopyBufferSize);
+
+            // Each worker gets its own reader from the pak pool
+            FSharedPakReader pakReader = pak.GetSharedReader(nullptr);
+#if PLATFORM_LINUX
+            if (options.bZeroCopy) {
+                worker.PakFileDescriptor = open(TCHAR_TO_UTF8(*pak.GetFilename()), O_RDONLY | O_CLOEXEC);
+            }
+#endif
+
+            const double startTime = FPlatformTime::Seconds();
+            for (int32 runIndex = nextRun++; runIndex < runs.Num(); runIndex = nextRun++) {
+                const FPakExtractRun &run = runs[runIndex];
+
+                // Merged runs are fetched with a single read, single entries are streamed from the pak reader
+                TUniquePtr<FPakRunReader> runReader;
+                if (run.NumItems > 1) {
+                    PAKTOOLS_STAGE_SCOPE(ReadRun, run.Size);
+                    worker.RunBuffer.SetNumUninitialized(run.Size, false);
+                    pakReader->Seek(run.Offset);
+                    pakReader->Serialize(worker.RunBuffer.GetData(), run.Size);
+                    runReader = MakeUnique<FPakRunReader>(worker.RunBuffer.GetData(), run.Offset, run.Size);
+                }
+                FArchive &source = runReader ? *runReader : pakReader.GetArchive();
+
+                for (int32 itemIndex = run.FirstItem; itemIndex < run.FirstItem + run.NumItems; itemIndex++) {
+                    if (processor(source, !runReader, items[itemIndex], worker)) {
+                        worker.ExtractedFiles++;
+                        outSucceeded[itemIndex] = true;
+                    } else {
+                        worker.FileErrors++;
+                    }
+                }
+            }
+            worker.Seconds = FPlatformTime::Seconds() - startTime;
+
+            FMemory::Free(worker.Buffer);
+            FMemory::Free(worker.CompressionBuffer);
+#if PLATFORM_LINUX
+            if (worker.PakFileDescriptor >= 0) {
+                close(worker.PakFileDescriptor);
+            }
+#endif
+        },
+        numWorkers == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::Unbalanced);
+
+    for (int32 workerIndex = 0; workerIndex < workers.Num(); workerIndex++) {
+        const FPakExtractWorker &worker = workers[workerIndex];
+        const double megabytes = worker.ExtractedBytes / 1024.0 / 1024.0;
+        UE_LOG(LogPakFile, Display, TEXT("Thread %d: %d files, %.2f MB in %.2f seconds (%.2f MB/s)"), workerIndex, worker.ExtractedFiles, megabytes, worker.Seconds,
+               worker.Seconds > 0 ? megabytes / worker.Seconds : 0.0);
+    }
+
+    UE_LOG(LogPakFile, Display, TEXT("Read sequentiality: %.1f%% (%d reads for %d entries)"), items.Num() > 1 ? 100.0 * sequentialItems / (items.Num() - 1) : 100.0, runs.Num(),
+           items.Num());
+}
+
+struct FIoStorePendingRead {
+    int32 ItemIndex = INDEX_NONE;
+    UE::Tasks::TTask<TIoStatusOr<FIoBuffer>> Task;
+};
+
+constexpr int32 GMaxPendingIoStoreReads = 1024;              // Caps the number of tasks when a container has lots of tiny chunks
+constexpr uint64 GIoStoreStreamWindowSize = 16 * 1024 * 1024; // Range read by streamed chunks, rounded to whole compression blocks
+
+// Chunks don't record their compression method, stats attribute the compressed ones to the (usually single) method of the container
+FName GetIoStoreCompressionMethod(const FIoStoreReader &ioStoreReader) {
+    for (const FName &method : ioStoreReader.GetCompressionMethods()) {
+        if (!method.IsNone()) {
+            return method;
+        }
+    }
+    return NAME_None;
+}
+
+bool WriteIoStoreChunk(const FIoStoreExtractItem &item, const FString &outputDir, TIoStatusOr<FIoBuffer> &buffer, FWriteBehindQueue *writeBehind) {
+    if (!buffer.IsOk()) {
+        UE_LOG(LogPakFile, Error, TEXT("Cannot read file \"%s\" %s."), *item.Filename, *buffer.Status().ToString());
+        return false;
+    }
+
+    FString destFilename(outputDir / *item.Filename);
+    if (writeBehind) {
+        writeBehind->Enqueue(MoveTemp(destFilename), buffer.ConsumeValueOrDie());
+        return true;
+    }
+
+    TUniquePtr<FArchive> fileHandle;
+    {
+        PAKTOOLS_STAGE_SCOPE(Create, int64(item.Size));
+        fileHandle.Reset(CreateOutputFileWriter(destFilename));
+    }
+    if (!fileHandle) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to create file \"%s\"."), *destFilename);
+        return false;
+    }
+
+    PAKTOOLS_STAGE_SCOPE(Write, int64(buffer.ValueOrDie().DataSize()));
+    const uint8 *data = buffer.ValueOrDie().GetData();
+    fileHandle->Serialize(const_cast<uint8 *>(data), buffer.ValueOrDie().DataSize());
+    if (!fileHandle->Close()) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to write file \"%s\"."), *destFilename);
+        fileHandle.Reset();
+        UnlinkOutputFile(destFilename);
+        return false;
+    }
+    return true;
+}
+
+// Reads the chunk as consecutive ranges, several of them decoding in parallel, and writes them in order. Memory use is bounded by maxInFlightBytes (at least
+// one window) whatever the size of the chunk.
+bool StreamIoStoreChunk(const FIoStoreReader &ioStoreReader, const FIoStoreExtractItem &item, uint64 maxInFlightBytes, FArchive &dest) {
+    // Windows start on block boundaries, so no block is decompressed twice
+    const uint64 blockSize = FMath::Max<uint64>(ioStoreReader.GetCompressionBlockSize(), 1);
+    const uint64 windowSize = FMath::Max<uint64>(GIoStoreStreamWindowSize / blockSize, 1) * blockSize;
+    const int32 maxPendingWindows = int32(FMath::Clamp<uint64>(maxInFlightBytes / windowSize, 1, GMaxPendingIoStoreReads));
+
+    TQueue<UE::Tasks::TTask<TIoStatusOr<FIoBuffer>>> pendingWindows;
+    int32 numPendingWindows = 0;
+    bool bSucceeded = true;
+
+    auto completeOldestWindow = [&] {
+        UE::Tasks::TTask<TIoStatusOr<FIoBuffer>> window;
+        pendingWindows.Dequeue(window);
+        numPendingWindows--;
+        {
+            PAKTOOLS_STAGE_SCOPE(IoStoreRead, 0);
+            window.Wait();
+        }
+
+        const TIoStatusOr<FIoBuffer> &buffer = window.GetResult();
+        if (!buffer.IsOk()) {
+            if (bSucceeded) {
+                UE_LOG(LogPakFile, Error, TEXT("Cannot read file \"%s\" %s."), *item.Filename, *buffer.Status().ToString());
+            }
+            bSucceeded = false;
+            return;
+        }
+        if (bSucceeded) {
+            PAKTOOLS_STAGE_SCOPE(Write, int64(buffer.ValueOrDie().DataSize()));
+            dest.Serialize(const_cast<uint8 *>(buffer.ValueOrDie().GetData()), int64(buffer.ValueOrDie().DataSize()));
+        }
+    };
 
-        FSharedPakReader pakReader = pak->GetSharedReader(nullptr);
+    for (uint64 offset = 0; offset < item.Size && bSucceeded; offset += windowSize) {
+        if (numPendingWindows >= maxPendingWindows) {
+            completeOldestWindow();
+        }
+        pendingWindows.Enqueue(ioStoreReader.ReadAsync(item.ChunkId, FIoReadOptions(offset, FMath::Min(windowSize, item.Size - offset))));
+        numPendingWindows++;
+    }
 
-        for (FPakFile::FPakEntryIterator it(*pak, false); it; ++it) {
+    // The reads still in flight reference the reader, they are waited for even after a failure
+    while (numPendingWindows > 0) {
+        completeOldestWindow();
+    }
+    return bSucceeded && !dest.IsError();
+}
+
+bool StreamIoStoreChunkToFile(const FIoStoreReader &ioStoreReader, const FIoStoreExtractItem &item, const FString &outputDir, uint64 maxInFlightBytes,
+                              FWriteBehindQueue *writeBehind) {
+    const FString destFilename(outputDir / item.Filename);
+    TUniquePtr<FArchive> fileHandle;
+    {
+        PAKTOOLS_STAGE_SCOPE(Create, int64(item.Size));
+        fileHandle.Reset(writeBehind ? writeBehind->CreatePreallocatedWriter(destFilename, int64(item.Size)) : CreateOutputFileWriter(destFilename));
+    }
+    if (!fileHandle) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to create file \"%s\"."), *destFilename);
+        return false;
+    }
+
+    bool bWritten = StreamIoStoreChunk(ioStoreReader, item, maxInFlightBytes, *fileHandle);
+    {
+        PAKTOOLS_STAGE_SCOPE(Write, 0);
+        bWritten &= fileHandle->Close();
+    }
+    if (!bWritten) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to write file \"%s\"."), *destFilename);
+        fileHandle.Reset();
+        UnlinkOutputFile(destFilename);
+    }
+    return bWritten;
+}
+
+bool StreamIoStoreChunkToTar(const FIoStoreReader &ioStoreReader, const FIoStoreExtractItem &item, uint64 maxInFlightBytes, FTarWriter &tarWriter) {
+    if (!tarWriter.BeginFile(item.Filename, int64(item.Size))) {
+        return false;
+    }
+    const bool bStreamed = StreamIoStoreChunk(ioStoreReader, item, maxInFlightBytes, tarWriter);
+    // EndFile pads a truncated entry, so the archive stays readable after a failed read
+    return tarWriter.EndFile() && bStreamed;
+}
+
+bool WriteIoStoreChunkToTar(const FIoStoreExtractItem &item, const TIoStatusOr<FIoBuffer> &buffer, FTarWriter &tarWriter) {
+    if (!buffer.IsOk()) {
+        UE_LOG(LogPakFile, Error, TEXT("Cannot read file \"%s\" %s."), *item.Filename, *buffer.Status().ToString());
+        return false;
+    }
+
+    const FIoBuffer &data = buffer.ValueOrDie();
+    PAKTOOLS_STAGE_SCOPE(Write, int64(data.DataSize()));
+    if (!tarWriter.BeginFile(item.Filename, int64(data.DataSize()))) {
+        return false;
+    }
+    tarWriter.Serialize(const_cast<uint8 *>(data.GetData()), int64(data.DataSize()));
+    return tarWriter.EndFile();
+}
+
+// Builds the pak work list. Without filters every entry is visited, otherwise only the matching paths are resolved through the index: listed files are looked
+// up by hash and patterns only walk the directories below their non-wildcard prefix.
+// Paths are the mount point without its initial dots followed by the path of the entry, as written on disk and as the IoStore paths. The filters apply to
+// these paths, so the same file list or pattern selects a file whichever container it comes from.
+void CollectPakItems(const FPakFile &pak, const FExtractOptions &options, TArray<FPakExtractItem> &outItems) {
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_CollectPakItems);
+    const FString &mountPoint = pak.GetMountPoint();
+    const FString mountPrefix = GetFileWithoutInitialDots(mountPoint);
+    if (!HasPathFilters(options)) {
+        for (FPakFile::FPakEntryIterator it(pak, false); it; ++it) {
             const FString *filename = it.TryGetFilename();
             if (filename == nullptr) {
                 UE_LOG(LogPakFile, Error, TEXT("Unable to get filename for pak file entry."));
                 continue;
             }
+            const FString path = mountPrefix / *filename;
+            if (!IsPathExcluded(path, options)) {
+                outItems.Add({path, it.Info()});
+            }
+        }
+        return;
+    }
 
-            FString destFilename(absoluteOutputDir / *filename);
-
-            UE_LOG(LogPakFile, Display, TEXT("Extracting '%s'"), *destFilename);
+    TSet<FString> addedFiles;
+    auto addFile = [&](const FString &path, const FString &pakPath) {
+        if (addedFiles.Contains(path) || IsPathExcluded(path, options)) {
+            return true;
+        }
+        FPakEntry entry;
+        if (pak.Find(mountPoint / pakPath, &entry) != FPakFile::EFindResult::Found) {
+            return false;
+        }
+        addedFiles.Add(path);
+        outItems.Add({path, entry});
+        return true;
+    };
 
-            pakReader->Seek(it.Info().Offset);
+    for (const FString &filename : options.FileList) {
+        FString pakPath;
+        if (!GetPathUnderMountPrefix(mountPrefix, filename, pakPath) || pakPath.IsEmpty() || !addFile(filename, pakPath)) {
+            UE_LOG(LogPakFile, Warning, TEXT("File '%s' not found in pak."), *filename);
+        }
+    }
 
-            FPakEntry EntryInfo;
-            EntryInfo.Serialize(pakReader.GetArchive(), pak->GetInfo().Version);
-            if (!EntryInfo.IndexDataEquals(it.Info())) {
-                UE_LOG(LogPakFile, Error, TEXT("PakEntry mismatch for \"%s\"."), **filename);
-                fileErrors++;
+    for (const FString &pattern : options.IncludePatterns) {
+        FString pakDirectory;
+        if (!GetPathUnderMountPrefix(mountPrefix, GetWildcardDirectory(pattern), pakDirectory)) {
+            continue;
+        }
+        TArray<FString> files;
+        pak.FindPrunedFilesAtPath(files, *(mountPoint / pakDirectory / TEXT("")), true, false, true);
+        for (const FString &fullPath : files) {
+            if (!fullPath.StartsWith(mountPoint)) {
                 continue;
             }
+            const FString pakPath = fullPath.RightChop(mountPoint.Len());
+            const FString path = mountPrefix / pakPath;
+            if (path.MatchesWildcard(pattern)) {
+                addFile(path, pakPath);
+            }
+        }
+    }
+}
 
-            TUniquePtr<FArchive> FileHandle(IFileManager::Get().CreateFileWriter(*destFilename));
-            if (!FileHandle) {
-                UE_LOG(LogPakFile, Error, TEXT("Unable to create file \"%s\"."), *destFilename);
-                fileErrors++;
-                continue;
+// Walks the directory index down to the given directory (relative to the index root), returns an invalid handle if it doesn't exist
+FIoDirectoryIndexHandle FindIoStoreDirectory(const FIoDirectoryIndexReader &indexReader, const FString &directory) {
+    TArray<FString> components;
+    directory.ParseIntoArray(components, TEXT("/"));
+
+    FIoDirectoryIndexHandle handle = FIoDirectoryIndexHandle::RootDirectory();
+    for (const FString &component : components) {
+        FIoDirectoryIndexHandle child = indexReader.GetChildDirectory(handle);
+        while (child.IsValid() && !indexReader.GetDirectoryName(child).Equals(component, ESearchCase::IgnoreCase)) {
+            child = indexReader.GetNextDirectory(child);
+        }
+        if (!child.IsValid()) {
+            return FIoDirectoryIndexHandle::Invalid();
+        }
+        handle = child;
+    }
+    return handle;
+}
+
+// Same as CollectPakItems, but for the IoStore directory index, whose paths already start with the mount point.
+void CollectIoStoreItems(const FIoStoreReader &ioStoreReader, const FExtractOptions &options, TArray<FIoStoreExtractItem> &outItems) {
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_CollectIoStoreItems);
+    const FIoDirectoryIndexReader &indexReader = ioStoreReader.GetDirectoryIndexReader();
+    const FString mountPrefix = GetFileWithoutInitialDots(indexReader.GetMountPoint());
+
+    TSet<uint32> addedEntries;
+    auto addEntry = [&](const FString &filename, uint32 tocEntryIndex) {
+        if (addedEntries.Contains(tocEntryIndex) || IsPathExcluded(filename, options)) {
+            return;
+        }
+
+        TIoStatusOr<FIoStoreTocChunkInfo> chunkInfo = ioStoreReader.GetChunkInfo(tocEntryIndex);
+        if (!chunkInfo.IsOk()) {
+            UE_LOG(LogPakFile, Error, TEXT("Unable to get chunk info for '%s' %s."), *filename, *chunkInfo.Status().ToString());
+            return;
+        }
+
+        const FIoStoreTocChunkInfo &info = chunkInfo.ValueOrDie();
+        addedEntries.Add(tocEntryIndex);
+        outItems.Add({filename, info.Id, info.Size, info.PartitionIndex, info.OffsetOnDisk, info.CompressedSize, info.Hash});
+    };
+
+    const FString *currentPattern = nullptr;
+    auto visitor = [&](const FString &filename, uint32 TocEntryIndex) -> bool {
+        const FString actualFilename = GetFileWithoutInitialDots(filename);
+        if (currentPattern == nullptr || actualFilename.MatchesWildcard(*currentPattern)) {
+            addEntry(actualFilename, TocEntryIndex);
+        }
+        return true;
+    };
+
+    if (!HasPathFilters(options)) {
+        indexReader.IterateDirectoryIndex(FIoDirectoryIndexHandle::RootDirectory(), TEXT(""), visitor);
+        return;
+    }
+
+    for (const FString &filename : options.FileList) {
+        FString indexPath;
+        FIoDirectoryIndexHandle directory =
+            GetPathUnderMountPrefix(mountPrefix, filename, indexPath) ? FindIoStoreDirectory(indexReader, FPaths::GetPath(indexPath)) : FIoDirectoryIndexHandle::Invalid();
+        const FString name = FPaths::GetCleanFilename(indexPath);
+
+        FIoDirectoryIndexHandle file = directory.IsValid() ? indexReader.GetFile(directory) : FIoDirectoryIndexHandle::Invalid();
+        while (file.IsValid() && !indexReader.GetFileName(file).Equals(name, ESearchCase::IgnoreCase)) {
+            file = indexReader.GetNextFile(file);
+        }
+
+        if (file.IsValid()) {
+            addEntry(filename, indexReader.GetFileData(file));
+        } else {
+            UE_LOG(LogPakFile, Warning, TEXT("File '%s' not found in container."), *filename);
+        }
+    }
+
+    for (const FString &pattern : options.IncludePatterns) {
+        FString indexDirectory;
+        if (!GetPathUnderMountPrefix(mountPrefix, GetWildcardDirectory(pattern), indexDirectory)) {
+            continue;
+        }
+        const FIoDirectoryIndexHandle directory = FindIoStoreDirectory(indexReader, indexDirectory);
+        if (directory.IsValid()) {
+            currentPattern = &pattern;
+            indexReader.IterateDirectoryIndex(directory, indexDirectory, visitor);
+        }
+    }
+}
+
+FString GetItemHash(const FPakExtractItem &item) {
+    return GetPakEntryHash(item.Entry);
+}
+
+FString GetItemHash(const FIoStoreExtractItem &item) {
+    return GetIoChunkHash(item.Hash);
+}
+
+int64 GetItemSize(const FPakExtractItem &item) {
+    return item.Entry.UncompressedSize;
+}
+
+int64 GetItemSize(const FIoStoreExtractItem &item) {
+    return int64(item.Size);
+}
+
+// Drops the items whose output was written by a previous run from the same payload, only the index and a stat of the output are needed for that
+template <typename ItemType>
+void RemoveUnchangedItems(TArray<ItemType> &items, const FExtractManifest &manifest, const FString &outputDir) {
+    const int32 numItems = items.Num();
+    items.RemoveAll([&](const ItemType &item) {
+        const FExtractManifestRecord *record = manifest.Find(item.Filename);
+        return record && record->Size == GetItemSize(item) && record->Hash == GetItemHash(item) && IFileManager::Get().FileSize(*(outputDir / item.Filename)) == record->Size;
+    });
+    UE_LOG(LogPakFile, Display, TEXT("Incremental: %d of %d files are unchanged and skipped"), numItems - items.Num(), numItems);
+}
+
+// Records the extracted items, and drops the records of the failed ones: their output may be missing or partial
+template <typename ItemType>
+void UpdateManifestRecords(const TArray<ItemType> &items, const TArray<bool> &extractedItems, FExtractManifest &manifest) {
+    for (int32 itemIndex = 0; itemIndex < items.Num(); itemIndex++) {
+        if (extractedItems[itemIndex]) {
+            manifest.Add(items[itemIndex].Filename, {GetItemSize(items[itemIndex]), GetItemHash(items[itemIndex])});
+        } else {
+            manifest.Remove(items[itemIndex].Filename);
+        }
+    }
+}
+
+struct FDedupSummary {
+    int32 LinkedFiles = 0;
+    int32 CopiedFiles = 0;
+    int64 LinkedBytes = 0;
+    int64 CopiedBytes = 0;
+    double LinkSeconds = 0.0;
+    // Files decoded by the same runs, to estimate what the deduplicated ones would have cost
+    int64 ExtractedBytes = 0;
+    double ExtractSeconds = 0.0;
+};
+
+// Pak hashes cover the stored (compressed, encrypted) data and IoStore hashes the chunk, their hex lengths differ so they never match each other
+FString GetDedupKey(const FString &hash, int64 size) {
+    for (const TCHAR character : hash) {
+        if (character != TEXT('0')) {
+            return FString::Printf(TEXT("%s/%lld"), *hash, size);
+        }
+    }
+    return FString();
+}
+
+// Moves the items whose content is already in the output directory, or earlier in the list, to outDuplicates along with the file they can be linked to
+template <typename ItemType>
+void SplitDuplicateItems(TArray<ItemType> &items, const FExtractManifest &manifest, const FString &outputDir, TArray<TPair<ItemType, FString>> &outDuplicates) {
+    TSet<FString> rewrittenFiles;
+    for (const ItemType &item : items) {
+        rewrittenFiles.Add(item.Filename);
+    }
+
+    // Files of previous runs (possibly from other containers) that stay untouched by this one
+    TMap<FString, FString> manifestSources;
+    for (const auto &record : manifest) {
+        const FString key = GetDedupKey(record.Value.Hash, record.Value.Size);
+        if (!key.IsEmpty() && !rewrittenFiles.Contains(record.Key)) {
+            manifestSources.Add(key, record.Key);
+        }
+    }
+
+    TMap<FString, FString> sources;
+    TArray<ItemType> uniqueItems;
+    uniqueItems.Reserve(items.Num());
+    for (ItemType &item : items) {
+        const FString key = GetDedupKey(GetItemHash(item), GetItemSize(item));
+        const FString *source = key.IsEmpty() ? nullptr : sources.Find(key);
+        if (source == nullptr && !key.IsEmpty()) {
+            // The recorded file may have been deleted or modified since
+            FString manifestSource;
+            if (manifestSources.RemoveAndCopyValue(key, manifestSource) && IFileManager::Get().FileSize(*(outputDir / manifestSource)) == GetItemSize(item)) {
+                source = &sources.Add(key, manifestSource);
             }
+        }
 
-            if (it.Info().CompressionMethodIndex == 0) {
-                if (!BufferedCopyFile(*FileHandle, pakReader.GetArchive(), it.Info(), Buffer, bufferSize, keyChain)) {
-                    fileErrors++;
-                }
-            } else {
-                if (!UncompressCopyFile(*FileHandle, pakReader.GetArchive(), it.Info(), persistantCompressionBuffer, compressionBufferSize, keyChain, *pak)) {
-                    fileErrors++;
-                }
+        if (source) {
+            outDuplicates.Emplace(MoveTemp(item), *source);
+            continue;
+        }
+
+        if (!key.IsEmpty()) {
+            sources.Add(key, item.Filename);
+        }
+        uniqueItems.Add(MoveTemp(item));
+    }
+
+    if (outDuplicates.Num() > 0) {
+        UE_LOG(LogPakFile, Display, TEXT("Dedup: %d of %d files have the same content as another file and will be linked"), outDuplicates.Num(),
+               outDuplicates.Num() + uniqueItems.Num());
+    }
+    items = MoveTemp(uniqueItems);
+}
+
+template <typename ItemType>
+void LinkDuplicateItems(const TArray<ItemType> &items, const TArray<bool> &extractedItems, const TArray<TPair<ItemType, FString>> &duplicates, const FString &outputDir,
+                        const FExtractOptions &options, FExtractManifest &manifest, FDedupSummary &summary, int32 &fileErrors) {
+    TSet<FString> failedFiles;
+    for (int32 itemIndex = 0; itemIndex < items.Num(); itemIndex++) {
+        if (!extractedItems[itemIndex]) {
+            failedFiles.Add(items[itemIndex].Filename);
+        }
+    }
+
+    const double startTime = FPlatformTime::Seconds();
+    for (const TPair<ItemType, FString> &duplicate : duplicates) {
+        const ItemType &item = duplicate.Key;
+        if (failedFiles.Contains(duplicate.Value)) {
+            UE_LOG(LogPakFile, Error, TEXT("Unable to extract '%s', the identical file '%s' failed."), *item.Filename, *duplicate.Value);
+            manifest.Remove(item.Filename);
+            fileErrors++;
+            continue;
+        }
+
+        UE_LOG(LogPakFile, Display, TEXT("Linking '%s' to '%s'"), *item.Filename, *duplicate.Value);
+        EFileLinkResult result;
+        {
+            PAKTOOLS_STAGE_SCOPE(Link, GetItemSize(item));
+            result = LinkOrCopyFile(outputDir / duplicate.Value, outputDir / item.Filename, options.bDedupReflink);
+        }
+        if (result == EFileLinkResult::Failed) {
+            UE_LOG(LogPakFile, Error, TEXT("Unable to link '%s' to '%s'."), *item.Filename, *duplicate.Value);
+            manifest.Remove(item.Filename);
+            fileErrors++;
+            continue;
+        }
+
+        if (result == EFileLinkResult::Linked) {
+            summary.LinkedFiles++;
+            summary.LinkedBytes += GetItemSize(item);
+        } else {
+            summary.CopiedFiles++;
+            summary.CopiedBytes += GetItemSize(item);
+        }
+        manifest.Add(item.Filename, {GetItemSize(item), GetItemHash(item)});
+    }
+    summary.LinkSeconds += FPlatformTime::Seconds() - startTime;
+}
+
+template <typename ItemType>
+void AddExtractedBytes(const TArray<ItemType> &items, const TArray<bool> &extractedItems, double seconds, FDedupSummary &summary) {
+    for (int32 itemIndex = 0; itemIndex < items.Num(); itemIndex++) {
+        if (extractedItems[itemIndex]) {
+            summary.ExtractedBytes += GetItemSize(items[itemIndex]);
+        }
+    }
+    summary.ExtractSeconds += seconds;
+}
+
+void LogDedupSummary(const FDedupSummary &summary) {
+    const int64 savedBytes = summary.LinkedBytes + summary.CopiedBytes;
+    // Deduplicated files would have been decoded at the rate of the extracted ones
+    const double savedSeconds =
+        summary.ExtractedBytes > 0 ? double(savedBytes) * summary.ExtractSeconds / double(summary.ExtractedBytes) - summary.LinkSeconds : 0.0;
+    UE_LOG(LogPakFile, Display, TEXT("Dedup: %d files linked (%s not written), %d copied, %s not decoded in %.2f seconds, about %.2f seconds saved"), summary.LinkedFiles,
+           *HumanSize(summary.LinkedBytes), summary.CopiedFiles, *HumanSize(savedBytes), summary.LinkSeconds, FMath::Max(savedSeconds, 0.0));
+}
+
+TUniquePtr<FWriteBehindQueue> CreateWriteBehindQueue(const FExtractOptions &options) {
+    if (options.WriteThreads <= 0) {
+        return nullptr;
+    }
+    return MakeUnique<FWriteBehindQueue>(options.WriteThreads, int64(FMath::Max(options.WriteBehindMB, 1)) * 1024 * 1024);
+}
+
+// Waits for the queued files, the ones that could not be written are counted as errors and left out of the manifest
+template <typename ItemType>
+void FlushWriteBehindQueue(const TArray<ItemType> &items, const FString &outputDir, FWriteBehindQueue *writeBehind, TArray<bool> &extractedItems, int32 &fileErrors) {
+    if (writeBehind == nullptr) {
+        return;
+    }
+    writeBehind->Flush();
+
+    const TSet<FString> failedFiles = writeBehind->GetFailedFiles();
+    for (int32 itemIndex = 0; itemIndex < items.Num() && failedFiles.Num() > 0; itemIndex++) {
+        if (extractedItems[itemIndex] && failedFiles.Contains(outputDir / items[itemIndex].Filename)) {
+            extractedItems[itemIndex] = false;
+            fileErrors++;
+        }
+    }
+}
+
+// Same rule as the pak platform file: "_P" patches go over the other containers, "_<N>_P" over "_P" and the lower versions
+int32 GetPatchLevel(const FString &path) {
+    const FString name = FPaths::GetBaseFilename(path);
+    if (!name.EndsWith(TEXT("_P"))) {
+        return 0;
+    }
+
+    const FString stripped = name.LeftChop(2);
+    int32 separatorIndex = INDEX_NONE;
+    if (stripped.FindLastChar(TEXT('_'), separatorIndex)) {
+        const FString version = stripped.RightChop(separatorIndex + 1);
+        if (version.IsNumeric() && FCString::Atoi(*version) >= 1) {
+            return FCString::Atoi(*version) + 1;
+        }
+    }
+    return 1;
+}
+
+// Items of all containers are named by their path under the mount point, so the same file has the same path in every container
+bool OpenExtractContainer(const FKeyChain &keyChain, const FString &path, const FExtractOptions &options, FExtractContainer &outContainer) {
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_OpenExtractContainer);
+    if (!FPaths::FileExists(path)) {
+        UE_LOG(LogPakFile, Error, TEXT("Pak file '%s' does not exist."), *path);
+        return false;
+    }
+
+    outContainer.Path = path;
+    outContainer.PatchLevel = GetPatchLevel(path);
+
+    const FString extension = FPaths::GetExtension(path);
+    if (extension == TEXT("pak")) {
+        outContainer.Pak = OpenPakFile(path, keyChain);
+        if (!outContainer.Pak) {
+            return false;
+        }
+
+        const FPakFile &pak = *outContainer.Pak;
+        UE_LOG(LogPakFile, Display, TEXT("Mount Point: %s"), *pak.GetMountPoint());
+
+        if (!pak.HasFilenames()) {
+            UE_LOG(LogPakFile, Error, TEXT("PakFiles were loaded without filenames, cannot extract."));
+            return false;
+        }
+
+        // Collect the work list first, so it can be split across workers
+        CollectPakItems(pak, options, outContainer.PakItems);
+        const FString mountPrefix = GetFileWithoutInitialDots(pak.GetMountPoint());
+        for (FPakFile::FPakEntryIterator it(pak, true); it; ++it) {
+            const FString *filename = it.TryGetFilename();
+            if (filename && it.Info().IsDeleteRecord()) {
+                outContainer.DeletedFiles.Add(mountPrefix / *filename);
             }
         }
+        return true;
+    }
 
-    } else if (extension == TEXT("utoc")) {
-        auto ioStoreReader = CreateIoStoreReader(absolutePakFile, keyChain);
-        if (!ioStoreReader) {
+    if (extension == TEXT("utoc")) {
+        outContainer.IoStoreReader = CreateIoStoreReader(path, keyChain);
+        if (!outContainer.IoStoreReader) {
             return false;
         }
 
         UE_LOG(LogPakFile, Display, TEXT("Reading from IoStore"));
-        UE_LOG(LogPakFile, Display, TEXT("  Mount Point: %s"), *ioStoreReader->GetDirectoryIndexReader().GetMountPoint());
+        UE_LOG(LogPakFile, Display, TEXT("  Mount Point: %s"), *outContainer.IoStoreReader->GetDirectoryIndexReader().GetMountPoint());
+
+        CollectIoStoreItems(*outContainer.IoStoreReader, options, outContainer.IoStoreItems);
+        return true;
+    }
+
+    UE_LOG(LogPakFile, Error, TEXT("Expected .pak or .utoc file but got '%s'"), *path);
+    return false;
+}
 
-        auto visitor = [&](const FString &filename, uint32 TocEntryIndex) -> bool {
-            TIoStatusOr<FIoStoreTocChunkInfo> chunkInfo = ioStoreReader->GetChunkInfo(TocEntryIndex);
-            const auto actualFilename = GetFileWithoutInitialDots(filename);
-            UE_LOG(LogPakFile, Display, TEXT("Extracting '%s'"), *actualFilename);
+// Keeps only the version of each path that would be mounted: from the container with the highest priority, unless a patch with a higher one deleted it
+void ResolveOverlay(TArray<FExtractContainer> &containers) {
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_ResolveOverlay);
+
+    // Stable, so the command line order decides between containers of the same patch level
+    Algo::StableSortBy(containers, &FExtractContainer::PatchLevel);
+
+    TMap<FString, int32> winners;
+    for (int32 containerIndex = 0; containerIndex < containers.Num(); containerIndex++) {
+        const FExtractContainer &container = containers[containerIndex];
+        for (const FString &filename : container.DeletedFiles) {
+            winners.Remove(filename);
+        }
+        for (const FPakExtractItem &item : container.PakItems) {
+            winners.Add(item.Filename, containerIndex);
+        }
+        for (const FIoStoreExtractItem &item : container.IoStoreItems) {
+            winners.Add(item.Filename, containerIndex);
+        }
+    }
 
-            if (!chunkInfo.IsOk()) {
-                UE_LOG(LogPakFile, Error, TEXT("Unable to get chunk info for '%s' %s."), *actualFilename, *chunkInfo.Status().ToString());
-                return true;
+    int32 numItems = 0;
+    int32 numSuperseded = 0;
+    int64 supersededBytes = 0;
+    for (int32 containerIndex = 0; containerIndex < containers.Num(); containerIndex++) {
+        auto isSuperseded = [&](const auto &item) {
+            const int32 *winner = winners.Find(item.Filename);
+            if (winner && *winner == containerIndex) {
+                return false;
             }
+            numSuperseded++;
+            supersededBytes += GetItemSize(item);
+            return true;
+        };
 
-            auto buffer = ioStoreReader->Read(chunkInfo.ValueOrDie().Id, {});
-            if (!buffer.IsOk()) {
-                UE_LOG(LogPakFile, Error, TEXT("Cannot read file \"%s\" %s."), *actualFilename, *buffer.Status().ToString());
-                fileErrors++;
-                return true;
+        FExtractContainer &container = containers[containerIndex];
+        numItems += container.PakItems.Num() + container.IoStoreItems.Num();
+        container.PakItems.RemoveAll(isSuperseded);
+        container.IoStoreItems.RemoveAll(isSuperseded);
+    }
+
+    UE_LOG(LogPakFile, Display, TEXT("Overlay: %d of %d entries (%s) are superseded or deleted by a higher priority container"), numSuperseded, numItems,
+           *HumanSize(supersededBytes));
+}
+
+void ExtractPakContainer(const FKeyChain &keyChain, const FPakFile &pak, TArray<FPakExtractItem> &items, const FString &outputDir, const FExtractOptions &options,
+                         FExtractManifest &manifest, FTarWriter *tarWriter, FDedupSummary &dedupSummary, int32 &fileErrors) {
+    if (options.bIncremental) {
+        RemoveUnchangedItems(items, manifest, outputDir);
+    }
+    TArray<TPair<FPakExtractItem, FString>> duplicates;
+    if (options.bDedup) {
+        SplitDuplicateItems(items, manifest, outputDir, duplicates);
+    }
+
+    const int32 numWorkers = FMath::Clamp(options.NumThreads, 1, FMath::Max(items.Num(), 1));
+    TArray<FPakExtractWorker> workers;
+    workers.SetNum(numWorkers);
+
+    if (numWorkers > 1) {
+        UE_LOG(LogPakFile, Display, TEXT("Extracting %d files using %d threads"), items.Num(), numWorkers);
+    }
+
+    const double extractStartTime = FPlatformTime::Seconds();
+    TUniquePtr<FWriteBehindQueue> writeBehind = CreateWriteBehindQueue(options);
+    TArray<bool> extractedItems;
+    ProcessPakItems(pak, items, options, workers, extractedItems,
+                    [&](FArchive &pakReader, bool bFromPakFile, const FPakExtractItem &item, FPakExtractWorker &worker) {
+                        if (tarWriter) {
+                            return ExtractPakEntryToTar(pak, pakReader, item, worker, keyChain, options, *tarWriter);
+                        }
+                        return ExtractPakEntry(pak, pakReader, bFromPakFile, item, outputDir, worker, keyChain, options, writeBehind.Get());
+                    });
+    FlushWriteBehindQueue(items, outputDir, writeBehind.Get(), extractedItems, fileErrors);
+    AddExtractedBytes(items, extractedItems, FPlatformTime::Seconds() - extractStartTime, dedupSummary);
+
+    int32 zeroCopyFiles = 0;
+    for (const FPakExtractWorker &worker : workers) {
+        fileErrors += worker.FileErrors;
+        zeroCopyFiles += worker.ZeroCopyFiles;
+    }
+
+    if (zeroCopyFiles > 0) {
+        UE_LOG(LogPakFile, Display, TEXT("%d stored files copied by the kernel without buffering"), zeroCopyFiles);
+    }
+
+    UpdateManifestRecords(items, extractedItems, manifest);
+    if (options.bDedup) {
+        LinkDuplicateItems(items, extractedItems, duplicates, outputDir, options, manifest, dedupSummary, fileErrors);
+    }
+}
+
+void ExtractIoStoreContainer(const FIoStoreReader &ioStoreReader, TArray<FIoStoreExtractItem> &items, const FString &outputDir, const FExtractOptions &options,
+                             FExtractManifest &manifest, FTarWriter *tarWriter, FDedupSummary &dedupSummary, int32 &fileErrors) {
+    if (options.bIncremental) {
+        RemoveUnchangedItems(items, manifest, outputDir);
+    }
+    TArray<TPair<FIoStoreExtractItem, FString>> duplicates;
+    if (options.bDedup) {
+        SplitDuplicateItems(items, manifest, outputDir, duplicates);
+    }
+
+    // Issue the reads in the order the compressed blocks are stored in the .ucas partitions
+    if (options.bSortByOffset) {
+        Algo::Sort(items, [](const FIoStoreExtractItem &a, const FIoStoreExtractItem &b) {
+            return a.PartitionIndex != b.PartitionIndex ? a.PartitionIndex < b.PartitionIndex : a.OffsetOnDisk < b.OffsetOnDisk;
+        });
+    }
+
+    int32 sequentialItems = 0;
+    for (int32 itemIndex = 1; itemIndex < items.Num(); itemIndex++) {
+        const FIoStoreExtractItem &previous = items[itemIndex - 1];
+        const FIoStoreExtractItem &current = items[itemIndex];
+        const uint64 previousEnd = previous.OffsetOnDisk + previous.CompressedSize;
+        if (current.PartitionIndex == previous.PartitionIndex && current.OffsetOnDisk >= previousEnd && current.OffsetOnDisk - previousEnd <= GMaxRunGap) {
+            sequentialItems++;
+        }
+    }
+
+    TArray<bool> extractedItems;
+    extractedItems.SetNumZeroed(items.Num());
+    const FName compressionMethod = GetIoStoreCompressionMethod(ioStoreReader);
+    TUniquePtr<FWriteBehindQueue> writeBehind = CreateWriteBehindQueue(options);
+    const double extractStartTime = FPlatformTime::Seconds();
+
+    // Chunks are read and decompressed asynchronously, completed chunks are written in order while later ones are still decoding. Chunks larger than the budget
+    // are streamed on their own, by ranges, so the budget also bounds the memory used by huge chunks.
+    const uint64 maxInFlightBytes = uint64(FMath::Max(options.InFlightMB, 0)) * 1024 * 1024;
+    TQueue<FIoStorePendingRead> pendingReads;
+    int32 numPendingReads = 0;
+    uint64 inFlightBytes = 0;
+
+    auto completeOldestRead = [&] {
+        FIoStorePendingRead pending;
+        pendingReads.Dequeue(pending);
+        numPendingReads--;
+
+        const FIoStoreExtractItem &item = items[pending.ItemIndex];
+        FExtractEntryScope entryScope(item.Filename, item.CompressedSize < item.Size ? compressionMethod : NAME_None, int64(item.CompressedSize), int64(item.Size));
+        {
+            PAKTOOLS_STAGE_SCOPE(IoStoreRead, int64(item.Size));
+            pending.Task.Wait();
+        }
+        const bool bWritten = tarWriter ? WriteIoStoreChunkToTar(item, pending.Task.GetResult(), *tarWriter)
+                                        : WriteIoStoreChunk(item, outputDir, pending.Task.GetResult(), writeBehind.Get());
+        if (bWritten) {
+            extractedItems[pending.ItemIndex] = true;
+        } else {
+            fileErrors++;
+        }
+        inFlightBytes -= item.Size;
+    };
+
+    for (int32 itemIndex = 0; itemIndex < items.Num(); itemIndex++) {
+        const FIoStoreExtractItem &item = items[itemIndex];
+        if (item.Size > maxInFlightBytes) {
+            while (numPendingReads > 0) {
+                completeOldestRead();
             }
 
-            const FString destFilename(absoluteOutputDir / *actualFilename);
-            const TUniquePtr<FArchive> fileHandle(IFileManager::Get().CreateFileWriter(*destFilename));
-            if (!fileHandle) {
-                UE_LOG(LogPakFile, Error, TEXT("Unable to create file \"%s\"."), *destFilename);
+            UE_LOG(LogPakFile, Display, TEXT("Extracting '%s' (streamed)"), *item.Filename);
+            FExtractEntryScope entryScope(item.Filename, item.CompressedSize < item.Size ? compressionMethod : NAME_None, int64(item.CompressedSize), int64(item.Size));
+            const bool bWritten = tarWriter ? StreamIoStoreChunkToTar(ioStoreReader, item, maxInFlightBytes, *tarWriter)
+                                            : StreamIoStoreChunkToFile(ioStoreReader, item, outputDir, maxInFlightBytes, writeBehind.Get());
+            if (bWritten) {
+                extractedItems[itemIndex] = true;
+            } else {
                 fileErrors++;
-                return false;
             }
+            continue;
+        }
 
-            const uint8 *data = buffer.ValueOrDie().GetData();
-            fileHandle->Serialize(const_cast<uint8 *>(data), buffer.ValueOrDie().DataSize());
-            fileHandle->Close();
+        while (numPendingReads > 0 && (inFlightBytes + item.Size > maxInFlightBytes || numPendingReads >= GMaxPendingIoStoreReads)) {
+            completeOldestRead();
+        }
 
-            return true;
-        };
-        ioStoreReader->GetDirectoryIndexReader().IterateDirectoryIndex(FIoDirectoryIndexHandle::RootDirectory(), TEXT(""), visitor);
+        UE_LOG(LogPakFile, Display, TEXT("Extracting '%s'"), *item.Filename);
+        pendingReads.Enqueue(FIoStorePendingRead{itemIndex, ioStoreReader.ReadAsync(item.ChunkId, FIoReadOptions())});
+        numPendingReads++;
+        inFlightBytes += item.Size;
+    }
+
+    while (numPendingReads > 0) {
+        completeOldestRead();
+    }
+    FlushWriteBehindQueue(items, outputDir, writeBehind.Get(), extractedItems, fileErrors);
+    AddExtractedBytes(items, extractedItems, FPlatformTime::Seconds() - extractStartTime, dedupSummary);
+
+    UpdateManifestRecords(items, extractedItems, manifest);
+    if (options.bDedup) {
+        LinkDuplicateItems(items, extractedItems, duplicates, outputDir, options, manifest, dedupSummary, fileErrors);
+    }
+
+    UE_LOG(LogPakFile, Display, TEXT("Read sequentiality: %.1f%% (%d chunks)"), items.Num() > 1 ? 100.0 * sequentialItems / (items.Num() - 1) : 100.0, items.Num());
+}
+
+bool ExtractFilesFromPak(const FKeyChain &keyChain, const TArray<FString> &pakFiles, const FString &outputDir, const FExtractOptions &options) {
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_ExtractFilesFromPak);
+    const FString absoluteOutputDir = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), outputDir);
+
+    if (options.ExtractTo.IsEmpty()) {
+        UE_LOG(LogPakFile, Display, TEXT("Output directory: %s"), *absoluteOutputDir);
     } else {
-        UE_LOG(LogPakFile, Error, TEXT("Expected .pak or .utoc file but got '%s'"), *absolutePakFile);
+        UE_LOG(LogPakFile, Display, TEXT("Output archive: %s"), options.ExtractTo == TEXT("-") ? TEXT("stdout") : *options.ExtractTo);
+    }
+
+    int32 fileErrors = 0;
+    FDedupSummary dedupSummary;
+
+    // All the containers are indexed up front, so only the winning version of each path gets decoded
+    TArray<FExtractContainer> containers;
+    containers.SetNum(pakFiles.Num());
+    int64 newestTimestamp = 0;
+    for (int32 containerIndex = 0; containerIndex < pakFiles.Num(); containerIndex++) {
+        const FString absolutePakFile = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), pakFiles[containerIndex]);
+        UE_LOG(LogPakFile, Display, TEXT("Extracting files from %s"), *absolutePakFile);
+        if (!OpenExtractContainer(keyChain, absolutePakFile, options, containers[containerIndex])) {
+            return false;
+        }
+        newestTimestamp = FMath::Max(newestTimestamp, IFileManager::Get().GetTimeStamp(*absolutePakFile).ToUnixTimestamp());
+    }
+    if (containers.Num() > 1) {
+        ResolveOverlay(containers);
+    }
+
+    // The archive is written sequentially: a single worker reads the entries in their physical order and streams them as they are decoded
+    FExtractOptions extractOptions = options;
+    TUniquePtr<FTarWriter> tarWriter;
+    if (!options.ExtractTo.IsEmpty()) {
+        if (options.bIncremental || options.bDedup) {
+            UE_LOG(LogPakFile, Error, TEXT("-Incremental and -Dedup need an output directory, they cannot be used with -ExtractTo."));
+            return false;
+        }
+        FArchive *output = CreateExtractToWriter(options.ExtractTo);
+        if (output == nullptr) {
+            UE_LOG(LogPakFile, Error, TEXT("Unable to create archive '%s'."), *options.ExtractTo);
+            return false;
+        }
+        tarWriter = MakeUnique<FTarWriter>(output, newestTimestamp);
+        extractOptions.NumThreads = 1;
+        extractOptions.bSortByOffset = true;
+        extractOptions.bZeroCopy = false;
+        extractOptions.WriteThreads = 0;
+    }
+
+    // Dedup links to the files recorded by previous runs, and records this one for the next. Any run writing into a directory with a manifest updates the
+    // records of the files it rewrites, so they never describe an older content.
+    FExtractManifest manifest;
+    const bool bUpdateManifest = !tarWriter && (LoadExtractManifest(absoluteOutputDir, manifest) || options.bIncremental || options.bDedup);
+
+    const double startTime = FPlatformTime::Seconds();
+    BeginExtractStats(options);
+    ON_SCOPE_EXIT { EndExtractStats(options, FPlatformTime::Seconds() - startTime); };
+
+    for (FExtractContainer &container : containers) {
+        if (container.Pak) {
+            ExtractPakContainer(keyChain, *container.Pak, container.PakItems, absoluteOutputDir, extractOptions, manifest, tarWriter.Get(), dedupSummary, fileErrors);
+        } else {
+            ExtractIoStoreContainer(*container.IoStoreReader, container.IoStoreItems, absoluteOutputDir, extractOptions, manifest, tarWriter.Get(), dedupSummary, fileErrors);
+        }
+    }
+
+    if (tarWriter && !tarWriter->Finish()) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to write archive '%s'."), *options.ExtractTo);
         return false;
     }
 
+    if (options.bDedup) {
+        LogDedupSummary(dedupSummary);
+    }
+
+    if (bUpdateManifest && !SaveExtractManifest(absoluteOutputDir, manifest)) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to write the extraction manifest in '%s'."), *absoluteOutputDir);
+    }
+
     if (fileErrors > 0) {
         UE_LOG(LogPakFile, Error, TEXT("Failed to extract %d files."), fileErrors);
     }
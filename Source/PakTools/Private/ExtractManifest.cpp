@@ -0,0 +1,46 @@
+﻿#include "Misc/FileHelper.h"
+#include "PakTools.h"
+
+namespace uetools {
+// Tab separated records (path, size, hash) written next to the extracted files
+static const TCHAR *GManifestFilename = TEXT(".PakToolsManifest.txt");
+static const TCHAR *GManifestHeader = TEXT("# PakTools extraction manifest v1");
+
+bool LoadExtractManifest(const FString &outputDir, FExtractManifest &outManifest) {
+    const FString manifestPath = outputDir / GManifestFilename;
+
+    TArray<FString> lines;
+    if (!IFileManager::Get().FileExists(*manifestPath) || !FFileHelper::LoadFileToStringArray(lines, *manifestPath)) {
+        return false;
+    }
+
+    if (lines.Num() == 0 || lines[0] != GManifestHeader) {
+        UE_LOG(LogPakFile, Warning, TEXT("Ignoring manifest '%s' with an unknown format."), *manifestPath);
+        return false;
+    }
+
+    outManifest.Reserve(lines.Num() - 1);
+    TArray<FString> fields;
+    for (int32 lineIndex = 1; lineIndex < lines.Num(); lineIndex++) {
+        lines[lineIndex].ParseIntoArray(fields, TEXT("\t"), false);
+        if (fields.Num() != 3) {
+            continue;
+        }
+        outManifest.Add(fields[0], {FCString::Atoi64(*fields[1]), fields[2]});
+    }
+
+    UE_LOG(LogPakFile, Display, TEXT("Loaded %d records from manifest '%s'."), outManifest.Num(), *manifestPath);
+    return true;
+}
+
+bool SaveExtractManifest(const FString &outputDir, const FExtractManifest &manifest) {
+    TArray<FString> lines;
+    lines.Reserve(manifest.Num() + 1);
+    lines.Add(GManifestHeader);
+    for (const auto &KV : manifest) {
+        lines.Add(FString::Printf(TEXT("%s\t%lld\t%s"), *KV.Key, KV.Value.Size, *KV.Value.Hash));
+    }
+
+    return FFileHelper::SaveStringArrayToFile(lines, *(outputDir / GManifestFilename), FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+}
+} // namespace uetools
@@ -0,0 +1,114 @@
+﻿#include "Dom/JsonObject.h"
+#include "ExtractStats.h"
+#include "Misc/FileHelper.h"
+#include "PakTools.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+namespace uetools {
+TRACE_DECLARE_INT_COUNTER(PakTools_ReadBytes, TEXT("PakTools/ReadBytes"));
+TRACE_DECLARE_INT_COUNTER(PakTools_ReadRunBytes, TEXT("PakTools/ReadRunBytes"));
+TRACE_DECLARE_INT_COUNTER(PakTools_DecryptBytes, TEXT("PakTools/DecryptBytes"));
+TRACE_DECLARE_INT_COUNTER(PakTools_DecompressBytes, TEXT("PakTools/DecompressBytes"));
+TRACE_DECLARE_INT_COUNTER(PakTools_IoStoreReadBytes, TEXT("PakTools/IoStoreReadBytes"));
+TRACE_DECLARE_INT_COUNTER(PakTools_CreateBytes, TEXT("PakTools/CreateBytes"));
+TRACE_DECLARE_INT_COUNTER(PakTools_WriteBytes, TEXT("PakTools/WriteBytes"));
+TRACE_DECLARE_INT_COUNTER(PakTools_LinkBytes, TEXT("PakTools/LinkBytes"));
+
+FExtractStats *GExtractStats = nullptr;
+
+static const TCHAR *GExtractStageNames[] = {TEXT("Read"), TEXT("ReadRun"), TEXT("Decrypt"), TEXT("Decompress"), TEXT("IoStoreRead"), TEXT("Create"), TEXT("Write"), TEXT("Link")};
+static_assert(UE_ARRAY_COUNT(GExtractStageNames) == int32(EExtractStage::Num), "Missing stage name");
+
+constexpr int32 GMaxSlowestEntries = 20;
+
+void FExtractStats::AddStage(EExtractStage stage, int64 bytes, uint64 cycles) {
+    StageCycles[int32(stage)] += cycles;
+    StageBytes[int32(stage)] += bytes;
+    StageCalls[int32(stage)]++;
+}
+
+void FExtractStats::AddEntry(FExtractEntryStats &&entry) {
+    auto isFaster = [](const FExtractEntryStats &a, const FExtractEntryStats &b) { return a.Seconds < b.Seconds; };
+
+    FScopeLock lock(&EntriesLock);
+    FCompressionMethodStats &method = CompressionMethods.FindOrAdd(entry.CompressionMethod);
+    method.Files++;
+    method.CompressedBytes += entry.CompressedSize;
+    method.UncompressedBytes += entry.UncompressedSize;
+    method.Seconds += entry.Seconds;
+
+    SlowestEntries.HeapPush(MoveTemp(entry), isFaster);
+    if (SlowestEntries.Num() > GMaxSlowestEntries) {
+        SlowestEntries.HeapPopDiscard(isFaster);
+    }
+}
+
+bool FExtractStats::Save(const FString &path, double wallSeconds) {
+    // Stage times are summed over all the threads, so they can add up to more than the wall time
+    TSharedRef<FJsonObject> stages = MakeShared<FJsonObject>();
+    for (int32 stageIndex = 0; stageIndex < int32(EExtractStage::Num); stageIndex++) {
+        TSharedRef<FJsonObject> stage = MakeShared<FJsonObject>();
+        const double seconds = FPlatformTime::ToSeconds64(StageCycles[stageIndex]);
+        const int64 bytes = StageBytes[stageIndex];
+        stage->SetNumberField(TEXT("Seconds"), seconds);
+        stage->SetNumberField(TEXT("Bytes"), double(bytes));
+        stage->SetNumberField(TEXT("Calls"), double(StageCalls[stageIndex]));
+        stage->SetNumberField(TEXT("MBPerSecond"), seconds > 0 ? bytes / 1024.0 / 1024.0 / seconds : 0.0);
+        stages->SetObjectField(GExtractStageNames[stageIndex], stage);
+    }
+
+    TSharedRef<FJsonObject> compressionMethods = MakeShared<FJsonObject>();
+    for (const auto &KV : CompressionMethods) {
+        TSharedRef<FJsonObject> method = MakeShared<FJsonObject>();
+        method->SetNumberField(TEXT("Files"), KV.Value.Files);
+        method->SetNumberField(TEXT("CompressedBytes"), double(KV.Value.CompressedBytes));
+        method->SetNumberField(TEXT("UncompressedBytes"), double(KV.Value.UncompressedBytes));
+        method->SetNumberField(TEXT("Seconds"), KV.Value.Seconds);
+        compressionMethods->SetObjectField(KV.Key.IsNone() ? TEXT("None") : KV.Key.ToString(), method);
+    }
+
+    SlowestEntries.Sort([](const FExtractEntryStats &a, const FExtractEntryStats &b) { return a.Seconds > b.Seconds; });
+    TArray<TSharedPtr<FJsonValue>> slowestEntries;
+    for (const FExtractEntryStats &entry : SlowestEntries) {
+        TSharedRef<FJsonObject> entryObject = MakeShared<FJsonObject>();
+        entryObject->SetStringField(TEXT("Filename"), entry.Filename);
+        entryObject->SetStringField(TEXT("CompressionMethod"), entry.CompressionMethod.IsNone() ? TEXT("None") : entry.CompressionMethod.ToString());
+        entryObject->SetNumberField(TEXT("CompressedSize"), double(entry.CompressedSize));
+        entryObject->SetNumberField(TEXT("UncompressedSize"), double(entry.UncompressedSize));
+        entryObject->SetNumberField(TEXT("Seconds"), entry.Seconds);
+        slowestEntries.Add(MakeShared<FJsonValueObject>(entryObject));
+    }
+
+    TSharedRef<FJsonObject> report = MakeShared<FJsonObject>();
+    report->SetNumberField(TEXT("WallSeconds"), wallSeconds);
+    report->SetObjectField(TEXT("Stages"), stages);
+    report->SetObjectField(TEXT("CompressionMethods"), compressionMethods);
+    report->SetArrayField(TEXT("SlowestEntries"), slowestEntries);
+
+    FString json;
+    FJsonSerializer::Serialize(report, TJsonWriterFactory<>::Create(&json));
+    return FFileHelper::SaveStringToFile(json, *path);
+}
+
+FExtractStats *BeginExtractStats(const FExtractOptions &options) {
+    check(GExtractStats == nullptr);
+    if (!options.StatsFile.IsEmpty()) {
+        GExtractStats = new FExtractStats();
+    }
+    return GExtractStats;
+}
+
+void EndExtractStats(const FExtractOptions &options, double wallSeconds) {
+    if (GExtractStats == nullptr) {
+        return;
+    }
+    if (GExtractStats->Save(options.StatsFile, wallSeconds)) {
+        UE_LOG(LogPakFile, Display, TEXT("Stats written to '%s'"), *options.StatsFile);
+    } else {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to write stats to '%s'."), *options.StatsFile);
+    }
+    delete GExtractStats;
+    GExtractStats = nullptr;
+}
+} // namespace uetools
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PakTools.h"
+#include "ProfilingDebugging/CountersTrace.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+#include <atomic>
+
+namespace uetools {
+// Stages of the extraction hot path, traced as CPU scopes and counters, and timed when -Stats is given
+enum class EExtractStage : uint8 {
+    Read,        // Pak reads issued by the copy functions (from memory when the entry is part of a merged run)
+    ReadRun,     // Merged reads of neighbouring pak entries
+    Decrypt,     // AES decryption of pak data
+    Decompress,  // Decompression of pak blocks
+    IoStoreRead, // Waiting for FIoStoreReader, which reads, decrypts and decompresses the chunk
+    Create,      // Creation of the output file (and its directory)
+    Write,       // Writes to the output file
+    Link,        // Hardlinks, clones or copies of deduplicated files
+    Num
+};
+
+struct FExtractEntryStats {
+    FString Filename;
+    FName CompressionMethod;
+    int64 CompressedSize = 0;
+    int64 UncompressedSize = 0;
+    double Seconds = 0;
+};
+
+struct FCompressionMethodStats {
+    int32 Files = 0;
+    int64 CompressedBytes = 0;
+    int64 UncompressedBytes = 0;
+    double Seconds = 0;
+};
+
+// Shared by all the workers of a -Extract or -Verify run, stages are summed with atomics and entries under a lock
+struct FExtractStats {
+    void AddStage(EExtractStage stage, int64 bytes, uint64 cycles);
+    void AddEntry(FExtractEntryStats &&entry);
+    bool Save(const FString &path, double wallSeconds);
+
+    std::atomic<uint64> StageCycles[int32(EExtractStage::Num)] = {};
+    std::atomic<int64> StageBytes[int32(EExtractStage::Num)] = {};
+    std::atomic<int64> StageCalls[int32(EExtractStage::Num)] = {};
+
+    FCriticalSection EntriesLock;
+    TMap<FName, FCompressionMethodStats> CompressionMethods;
+    TArray<FExtractEntryStats> SlowestEntries; // Min-heap on Seconds
+};
+
+// Stats of the current run, null unless -Stats is given
+extern FExtractStats *GExtractStats;
+
+class FExtractStageScope {
+  public:
+    FExtractStageScope(EExtractStage InStage, int64 InBytes)
+        : Stage(InStage)
+        , Bytes(InBytes)
+        , StartCycles(GExtractStats ? FPlatformTime::Cycles64() : 0) {}
+
+    ~FExtractStageScope() {
+        if (GExtractStats) {
+            GExtractStats->AddStage(Stage, Bytes, FPlatformTime::Cycles64() - StartCycles);
+        }
+    }
+
+  private:
+    EExtractStage Stage;
+    int64 Bytes;
+    uint64 StartCycles;
+};
+
+// Records the total time spent on one entry
+class FExtractEntryScope {
+  public:
+    FExtractEntryScope(const FString &Filename, FName CompressionMethod, int64 CompressedSize, int64 UncompressedSize)
+        : Entry{Filename, CompressionMethod, CompressedSize, UncompressedSize}
+        , StartTime(GExtractStats ? FPlatformTime::Seconds() : 0) {}
+
+    ~FExtractEntryScope() {
+        if (GExtractStats) {
+            Entry.Seconds = FPlatformTime::Seconds() - StartTime;
+            GExtractStats->AddEntry(MoveTemp(Entry));
+        }
+    }
+
+  private:
+    FExtractEntryStats Entry;
+    double StartTime;
+};
+
+TRACE_DECLARE_INT_COUNTER_EXTERN(PakTools_ReadBytes);
+TRACE_DECLARE_INT_COUNTER_EXTERN(PakTools_ReadRunBytes);
+TRACE_DECLARE_INT_COUNTER_EXTERN(PakTools_DecryptBytes);
+TRACE_DECLARE_INT_COUNTER_EXTERN(PakTools_DecompressBytes);
+TRACE_DECLARE_INT_COUNTER_EXTERN(PakTools_IoStoreReadBytes);
+TRACE_DECLARE_INT_COUNTER_EXTERN(PakTools_CreateBytes);
+TRACE_DECLARE_INT_COUNTER_EXTERN(PakTools_WriteBytes);
+TRACE_DECLARE_INT_COUNTER_EXTERN(PakTools_LinkBytes);
+
+#define PAKTOOLS_STAGE_SCOPE(Stage, Bytes)                                                                                                                                       \
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_##Stage);                                                                                                                             \
+    TRACE_COUNTER_ADD(PakTools_##Stage##Bytes, Bytes);                                                                                                                           \
+    uetools::FExtractStageScope PREPROCESSOR_JOIN(ExtractStageScope, __LINE__)(uetools::EExtractStage::Stage, Bytes)
+
+FExtractStats *BeginExtractStats(const FExtractOptions &options);
+void EndExtractStats(const FExtractOptions &options, double wallSeconds);
+} // namespace uetools
@@ -0,0 +1,78 @@
+﻿#include "PakTools.h"
+
+#if PLATFORM_WINDOWS
+#include "Windows/WindowsHWrapper.h"
+#elif PLATFORM_LINUX
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#elif PLATFORM_MAC
+#include <sys/clonefile.h>
+#include <unistd.h>
+#endif
+
+namespace uetools {
+// Copy-on-write clone, only supported by some filesystems (Btrfs, XFS, APFS)
+static bool CloneFile(const FString &source, const FString &dest) {
+#if PLATFORM_LINUX
+    const int sourceDescriptor = open(TCHAR_TO_UTF8(*source), O_RDONLY | O_CLOEXEC);
+    if (sourceDescriptor < 0) {
+        return false;
+    }
+    bool bCloned = false;
+    const int destDescriptor = open(TCHAR_TO_UTF8(*dest), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (destDescriptor >= 0) {
+        bCloned = ioctl(destDescriptor, FICLONE, sourceDescriptor) == 0;
+        close(destDescriptor);
+        if (!bCloned) {
+            unlink(TCHAR_TO_UTF8(*dest));
+        }
+    }
+    close(sourceDescriptor);
+    return bCloned;
+#elif PLATFORM_MAC
+    return clonefile(TCHAR_TO_UTF8(*source), TCHAR_TO_UTF8(*dest), 0) == 0;
+#else
+    // ReFS block cloning works per range on an allocated file, the copy fallback is used instead
+    return false;
+#endif
+}
+
+static bool HardLinkFile(const FString &source, const FString &dest) {
+#if PLATFORM_WINDOWS
+    return CreateHardLinkW(*dest, *source, nullptr) != 0;
+#elif PLATFORM_LINUX || PLATFORM_MAC
+    return link(TCHAR_TO_UTF8(*source), TCHAR_TO_UTF8(*dest)) == 0;
+#else
+    return false;
+#endif
+}
+
+void UnlinkOutputFile(const FString &filename) {
+    FPlatformFileManager::Get().GetPlatformFile().DeleteFile(*filename);
+}
+
+FArchive *CreateOutputFileWriter(const FString &filename) {
+    UnlinkOutputFile(filename);
+    return IFileManager::Get().CreateFileWriter(*filename);
+}
+
+EFileLinkResult LinkOrCopyFile(const FString &source, const FString &dest, bool bReflink) {
+    IPlatformFile &platformFile = FPlatformFileManager::Get().GetPlatformFile();
+
+    if (platformFile.FileExists(*dest) && !platformFile.DeleteFile(*dest)) {
+        return EFileLinkResult::Failed;
+    }
+    if (!platformFile.CreateDirectoryTree(*FPaths::GetPath(dest))) {
+        return EFileLinkResult::Failed;
+    }
+
+    if (bReflink ? CloneFile(source, dest) : HardLinkFile(source, dest)) {
+        return EFileLinkResult::Linked;
+    }
+
+    // Different volumes or a filesystem without links
+    return platformFile.CopyFile(*dest, *source) ? EFileLinkResult::Copied : EFileLinkResult::Failed;
+}
+} // namespace uetools
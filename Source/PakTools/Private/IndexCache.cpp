@@ -0,0 +1,218 @@
+﻿#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/SecureHash.h"
+#include "PakTools.h"
+
+namespace uetools {
+constexpr uint32 GIndexCacheMagic = 0x58495450; // "PTIX"
+constexpr uint32 GIndexCacheVersion = 1;
+
+// A cache file is this header, the entries sorted by path, then a blob of UTF-8 strings referenced by offset and size.
+// Everything is plain data so it can be used in place from the mapped file.
+struct FIndexCacheHeader {
+    uint32 Magic = GIndexCacheMagic;
+    uint32 Version = GIndexCacheVersion;
+    int64 ContainerSize = 0;
+    int64 ContainerTimestamp = 0;
+    FGuid EncryptionKeyGuid;
+    uint32 NumEntries = 0;
+    uint32 ContainerPathSize = 0; // The container path is the first string of the blob
+    uint64 StringsOffset = 0;
+    uint64 StringsSize = 0;
+};
+
+struct FIndexCacheEntry {
+    uint64 PathOffset = 0;
+    uint32 PathSize = 0;
+    uint8 bIoStore = 0;
+    uint8 HashSize = 0;
+    uint16 Padding = 0;
+    int64 UncompressedSize = 0;
+    int64 CompressedSize = 0;
+    int64 Offset = 0;
+    uint8 Hash[32] = {};
+};
+
+static FString GetIndexCachePath(const FString &cacheDir, const FString &containerPath) {
+    return cacheDir / FMD5::HashAnsiString(*containerPath) + TEXT(".idx");
+}
+
+// Read-only view of a cache file, only valid if it was written for the current version of the container
+class FMappedIndexCache {
+  public:
+    bool Open(const FString &cacheDir, const FString &containerPath, const FKeyChain &keyChain) {
+        const FString cachePath = GetIndexCachePath(cacheDir, containerPath);
+        if (!IFileManager::Get().FileExists(*cachePath)) {
+            return false;
+        }
+
+        Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*cachePath));
+        if (!Handle) {
+            return false;
+        }
+        Region.Reset(Handle->MapRegion());
+        if (!Region || Region->GetMappedSize() < int64(sizeof(FIndexCacheHeader))) {
+            return false;
+        }
+
+        const uint8 *data = Region->GetMappedPtr();
+        const int64 mappedSize = Region->GetMappedSize();
+        Header = reinterpret_cast<const FIndexCacheHeader *>(data);
+        if (Header->Magic != GIndexCacheMagic || Header->Version != GIndexCacheVersion ||
+            sizeof(FIndexCacheHeader) + uint64(Header->NumEntries) * sizeof(FIndexCacheEntry) > Header->StringsOffset ||
+            Header->StringsOffset + Header->StringsSize > uint64(mappedSize) || Header->ContainerPathSize > Header->StringsSize) {
+            return false;
+        }
+        Entries = reinterpret_cast<const FIndexCacheEntry *>(data + sizeof(FIndexCacheHeader));
+        Strings = reinterpret_cast<const ANSICHAR *>(data + Header->StringsOffset);
+
+        // The cache is keyed by path, size, timestamp and encryption key: any change to the container invalidates it
+        if (GetString(0, Header->ContainerPathSize) != containerPath || Header->ContainerSize != IFileManager::Get().FileSize(*containerPath) ||
+            Header->ContainerTimestamp != IFileManager::Get().GetTimeStamp(*containerPath).GetTicks()) {
+            return false;
+        }
+
+        // The index was decrypted with this key, don't hand it out to someone who doesn't have it
+        if (Header->EncryptionKeyGuid.IsValid() && !keyChain.GetEncryptionKeys().Contains(Header->EncryptionKeyGuid)) {
+            return false;
+        }
+
+        // Entries are used in place, a corrupt hash size would read past the hash
+        for (uint32 index = 0; index < Header->NumEntries; index++) {
+            if (Entries[index].HashSize > sizeof(FIndexCacheEntry::Hash)) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    int32 Num() const { return Header->NumEntries; }
+
+    FString GetPath(int32 index) const { return GetString(Entries[index].PathOffset, Entries[index].PathSize); }
+
+    FToolFileEntry GetEntry(int32 index) const {
+        const FIndexCacheEntry &entry = Entries[index];
+        return {GetPath(index), entry.UncompressedSize, entry.CompressedSize, entry.bIoStore ? TEXT("IoStore") : TEXT("Pak"), entry.Offset, BytesToHex(entry.Hash, entry.HashSize)};
+    }
+
+    // Binary search on the sorted entries, returns INDEX_NONE if the path is not in the container
+    int32 Find(const FString &path) const {
+        int32 low = 0;
+        int32 high = Num();
+        while (low < high) {
+            const int32 middle = low + (high - low) / 2;
+            if (FCString::Strcmp(*GetPath(middle), *path) < 0) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low < Num() && GetPath(low) == path ? low : INDEX_NONE;
+    }
+
+  private:
+    FString GetString(uint64 offset, uint32 size) const {
+        if (offset + size > Header->StringsSize) {
+            return FString();
+        }
+        const FUTF8ToTCHAR converted(Strings + offset, size);
+        return FString(converted.Length(), converted.Get());
+    }
+
+    TUniquePtr<IMappedFileHandle> Handle;
+    TUniquePtr<IMappedFileRegion> Region;
+    const FIndexCacheHeader *Header = nullptr;
+    const FIndexCacheEntry *Entries = nullptr;
+    const ANSICHAR *Strings = nullptr;
+};
+
+bool VisitCachedIndex(const FString &cacheDir, const FString &containerPath, const FKeyChain &keyChain, FToolFileEntryVisitor visitor) {
+    FMappedIndexCache cache;
+    if (!cache.Open(cacheDir, containerPath, keyChain)) {
+        return false;
+    }
+
+    UE_LOG(LogPakFile, Display, TEXT("Reading cached index of '%s'"), *containerPath);
+    for (int32 index = 0; index < cache.Num(); index++) {
+        visitor(cache.GetEntry(index));
+    }
+    return true;
+}
+
+bool FindInCachedIndex(const FString &cacheDir, const FString &containerPath, const FKeyChain &keyChain, const TArray<FString> &paths, FToolFileEntryVisitor visitor) {
+    FMappedIndexCache cache;
+    if (!cache.Open(cacheDir, containerPath, keyChain)) {
+        return false;
+    }
+
+    for (const FString &path : paths) {
+        const int32 index = cache.Find(path);
+        if (index != INDEX_NONE) {
+            visitor(cache.GetEntry(index));
+        }
+    }
+    return true;
+}
+
+bool WriteCachedIndex(const FString &cacheDir, const FString &containerPath, const FGuid &encryptionKeyGuid, const TArray<FToolFileEntry> &entries) {
+    TArray<int32> order;
+    order.Reserve(entries.Num());
+    for (int32 index = 0; index < entries.Num(); index++) {
+        order.Add(index);
+    }
+    order.Sort([&entries](int32 a, int32 b) { return FCString::Strcmp(*entries[a].Filename, *entries[b].Filename) < 0; });
+
+    TArray<ANSICHAR> strings;
+    auto appendString = [&strings](const FString &value, uint32 &outSize) -> uint64 {
+        const FTCHARToUTF8 converted(*value);
+        outSize = converted.Length();
+        const uint64 offset = strings.Num();
+        strings.Append(reinterpret_cast<const ANSICHAR *>(converted.Get()), converted.Length());
+        return offset;
+    };
+
+    FIndexCacheHeader header;
+    header.ContainerSize = IFileManager::Get().FileSize(*containerPath);
+    header.ContainerTimestamp = IFileManager::Get().GetTimeStamp(*containerPath).GetTicks();
+    header.EncryptionKeyGuid = encryptionKeyGuid;
+    header.NumEntries = entries.Num();
+    appendString(containerPath, header.ContainerPathSize);
+
+    TArray<FIndexCacheEntry> cacheEntries;
+    cacheEntries.SetNum(entries.Num());
+    for (int32 index = 0; index < order.Num(); index++) {
+        const FToolFileEntry &entry = entries[order[index]];
+        FIndexCacheEntry &cacheEntry = cacheEntries[index];
+        cacheEntry.PathOffset = appendString(entry.Filename, cacheEntry.PathSize);
+        cacheEntry.bIoStore = FCString::Strcmp(entry.Source, TEXT("IoStore")) == 0;
+        cacheEntry.UncompressedSize = entry.UncompressedSize;
+        cacheEntry.CompressedSize = entry.CompressedSize;
+        cacheEntry.Offset = entry.Offset;
+        if (entry.Hash.Len() <= 2 * int32(sizeof(cacheEntry.Hash))) {
+            cacheEntry.HashSize = HexToBytes(entry.Hash, cacheEntry.Hash);
+        }
+    }
+
+    header.StringsOffset = sizeof(FIndexCacheHeader) + cacheEntries.Num() * sizeof(FIndexCacheEntry);
+    header.StringsSize = strings.Num();
+
+    // Written next to the final file and renamed, so readers never map a partial cache
+    const FString cachePath = GetIndexCachePath(cacheDir, containerPath);
+    const FString temporaryPath = cachePath + TEXT(".tmp");
+    {
+        TUniquePtr<FArchive> writer(IFileManager::Get().CreateFileWriter(*temporaryPath));
+        if (!writer) {
+            UE_LOG(LogPakFile, Warning, TEXT("Unable to write index cache '%s'."), *temporaryPath);
+            return false;
+        }
+        writer->Serialize(&header, sizeof(header));
+        writer->Serialize(cacheEntries.GetData(), cacheEntries.Num() * sizeof(FIndexCacheEntry));
+        writer->Serialize(strings.GetData(), strings.Num());
+        if (!writer->Close()) {
+            return false;
+        }
+    }
+    return IFileManager::Get().Move(*cachePath, *temporaryPath, true, true);
+}
+} // namespace uetools
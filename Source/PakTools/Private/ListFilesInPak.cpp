@@ -3,20 +3,12 @@
 #include "PlatformFileManager.h"
 #include "Private/IoDispatcherFileBackend.h"
 
-// Defined in PakFileUtilities.cpp
-FString GetPakPath(const TCHAR *SpecifiedPath, bool bIsForCreation);
+#include <atomic>
 
 // Defined in IoDispatcherFileBackend.cpp
 TSharedRef<FFileIoStore> CreateIoDispatcherFileBackend();
 
 namespace uetools {
-struct FToolFileEntry {
-    FString Filename;
-    int64 UncompressedSize = 0;
-    int64 CompressedSize = 0;
-    const TCHAR *Source; // "Pak" or "IoStore"
-};
-
 FString HumanSize(int64 size) {
     const FString units[] = {TEXT("B"), TEXT("KB"), TEXT("MB"), TEXT("GB"), TEXT("TB"), TEXT("PB")};
     int32 unitIndex = 0;
@@ -31,15 +23,14 @@ FString HumanSize(int64 size) {
 }
 
 using FFullFileVisitor = TFunctionRef<bool(FString, const FIoDirectoryIndexHandle &)>;
-
-TOptional<TArray<FToolFileEntry>> ReadFileListFromPak(const FString &pakFilename, const FKeyChain &keyChain) {
+bool VisitFilesInPak(const FString &pakFilename, const FKeyChain &keyChain, FGuid &outEncryptionKeyGuid, FToolFileEntryVisitor visitor) {
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_VisitFilesInPak);
     const auto pakFile = OpenPakFile(pakFilename, keyChain);
 
-    if (!pakFile->IsValid()) {
-        return NullOpt;
+    if (!pakFile || !pakFile->IsValid()) {
+        return false;
     }
-
-    TArray<FToolFileEntry> result;
+    outEncryptionKeyGuid = pakFile->GetInfo().EncryptionKeyGuid;
 
     // Iterate over all files in the pak file
     for (FPakFile::FPakEntryIterator iterator(*pakFile, true); iterator; ++iterator) {
@@ -49,38 +40,36 @@ TOptional<TArray<FToolFileEntry>> ReadFileListFromPak(const FString &pakFilename
             continue;
         }
         FString fullPath = pakFile->GetMountPoint() / *filename;
-        result.Add({fullPath, iterator.Info().UncompressedSize, iterator.Info().Size, TEXT("Pak")});
+        const FPakEntry &entry = iterator.Info();
+        FToolFileEntry file{MoveTemp(fullPath), entry.UncompressedSize, entry.Size, TEXT("Pak"), entry.Offset, GetPakEntryHash(entry)};
+        file.CompressionMethod = pakFile->GetInfo().GetCompressionMethod(entry.CompressionMethodIndex);
+        file.bEncrypted = entry.IsEncrypted();
+        file.bDeleteRecord = entry.IsDeleteRecord();
+        visitor(MoveTemp(file));
     }
 
-    return result;
+    return true;
 }
 
-TOptional<TArray<FToolFileEntry>> ReadFileListFromToc(const FString &pakFilename, const FKeyChain &keyChain) {
+bool VisitFilesInToc(const FString &pakFilename, const FKeyChain &keyChain, FGuid &outEncryptionKeyGuid, FToolFileEntryVisitor visitor) {
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_VisitFilesInToc);
     // Iterate over all files in the utoc/ucas files
     auto ioStoreReader = CreateIoStoreReader(pakFilename, keyChain);
     if (!ioStoreReader) {
-        return NullOpt;
+        return false;
     }
+    outEncryptionKeyGuid = ioStoreReader->GetEncryptionKeyGuid();
     UE_LOG(LogPakFile, Display, TEXT("Reading from IoStore"));
     UE_LOG(LogPakFile, Display, TEXT("  Mount Point: %s"), *ioStoreReader->GetDirectoryIndexReader().GetMountPoint());
-    TArray<TPair<FString, FIoDirectoryIndexHandle>> entries;
-
-    // Populate ChunkFileNamesMap (unused for now)
-    TMap<FIoChunkId, FString> chunkFileNamesMap;
-    auto visitor = [&chunkFileNamesMap, &ioStoreReader](const FString &filename, uint32 TocEntryIndex) -> bool {
-        TIoStatusOr<FIoStoreTocChunkInfo> chunkInfo = ioStoreReader->GetChunkInfo(TocEntryIndex);
-        if (chunkInfo.IsOk()) {
-            chunkFileNamesMap.Add(chunkInfo.ValueOrDie().Id, filename);
-        }
-        return true;
-    };
-    ioStoreReader->GetDirectoryIndexReader().IterateDirectoryIndex(FIoDirectoryIndexHandle::RootDirectory(), TEXT(""), visitor);
 
-    // Populate SourceHashByChunkId
-    TMap<FIoChunkId, FIoStoreTocChunkInfo> sourceHashByChunkId;
-    TMap<FString, FToolFileEntry> fileEntriesByFilename;
+    // Chunks with a name in the directory index are unique and can be emitted right away, the others share a name per chunk type and are summed up
+    TMap<FString, FToolFileEntry> unnamedEntriesByFilename;
     ioStoreReader->EnumerateChunks([&](const FIoStoreTocChunkInfo &chunkInfo) {
-        FToolFileEntry &currentEntry = fileEntriesByFilename.FindOrAdd(chunkInfo.FileName);
+        if (chunkInfo.bHasValidFileName) {
+            visitor({chunkInfo.FileName, int64(chunkInfo.Size), int64(chunkInfo.CompressedSize), TEXT("IoStore"), int64(chunkInfo.OffsetOnDisk), GetIoChunkHash(chunkInfo.Hash)});
+            return true;
+        }
+        FToolFileEntry &currentEntry = unnamedEntriesByFilename.FindOrAdd(chunkInfo.FileName);
         currentEntry.Filename = chunkInfo.FileName;
         currentEntry.UncompressedSize += chunkInfo.Size;
         currentEntry.CompressedSize += chunkInfo.CompressedSize;
@@ -88,44 +77,123 @@ TOptional<TArray<FToolFileEntry>> ReadFileListFromToc(const FString &pakFilename
         return true;
     });
 
+    for (auto &KV : unnamedEntriesByFilename) {
+        visitor(MoveTemp(KV.Value));
+    }
+    return true;
+}
+
+bool VisitFilesInContainer(const FString &pakFilename, const FKeyChain &keyChain, FGuid &outEncryptionKeyGuid, FToolFileEntryVisitor visitor) {
+    const FString extension = FPaths::GetExtension(pakFilename);
+    if (extension == TEXT("pak")) {
+        return VisitFilesInPak(pakFilename, keyChain, outEncryptionKeyGuid, visitor);
+    }
+    if (extension == TEXT("utoc")) {
+        return VisitFilesInToc(pakFilename, keyChain, outEncryptionKeyGuid, visitor);
+    }
+    UE_LOG(LogPakFile, Error, TEXT("Expected .pak or .utoc file but got '%s'"), *pakFilename);
+    return false;
+}
+
+TOptional<TArray<FToolFileEntry>> ReadFileListFromPak(const FString &pakFilename, const FKeyChain &keyChain) {
     TArray<FToolFileEntry> result;
-    for (const auto &KV : fileEntriesByFilename) {
-        result.Add(KV.Value);
+    FGuid encryptionKeyGuid;
+    if (!VisitFilesInPak(pakFilename, keyChain, encryptionKeyGuid, [&result](FToolFileEntry &&entry) { result.Add(MoveTemp(entry)); })) {
+        return NullOpt;
     }
     return result;
 }
 
-bool ListFilesInPak(const TArray<FString> &pakFiles, const FKeyChain &keyChain) {
-    TArray<FToolFileEntry> files;
+TOptional<TArray<FToolFileEntry>> ReadFileListFromToc(const FString &pakFilename, const FKeyChain &keyChain) {
+    TArray<FToolFileEntry> result;
+    FGuid encryptionKeyGuid;
+    if (!VisitFilesInToc(pakFilename, keyChain, encryptionKeyGuid, [&result](FToolFileEntry &&entry) { result.Add(MoveTemp(entry)); })) {
+        return NullOpt;
+    }
+    return result;
+}
 
-    for (const FString &it : pakFiles) {
-        const FString pakFilename = GetPakPath(*it, false);
+void PrintFileEntry(const FToolFileEntry &file) {
+    UE_LOG(LogPakFile, Display, TEXT("%s (%s) [Compression: %.02f%%]"), *file.Filename, *HumanSize(file.CompressedSize), 100.0 * file.CompressedSize / file.UncompressedSize);
+}
 
-        const FString extension = FPaths::GetExtension(pakFilename);
-        if (extension == TEXT("pak")) {
-            auto result = ReadFileListFromPak(pakFilename, keyChain);
-            if (!result) {
-                return false;
+bool ListFilesInPak(const TArray<FString> &pakFiles, const FKeyChain &keyChain, const FListOptions &options) {
+    TArray<FString> pakFilenames;
+    for (const FString &it : pakFiles) {
+        pakFilenames.Add(GetContainerPath(it));
+    }
+    const TSet<FString> findPaths(options.FindPaths);
+
+    // Containers are opened and indexed in parallel, every one of them collects its own results
+    const auto byCompressedSize = [](const FToolFileEntry &a, const FToolFileEntry &b) { return a.CompressedSize < b.CompressedSize; };
+    TArray<TArray<FToolFileEntry>> filesByContainer;
+    filesByContainer.SetNum(pakFilenames.Num());
+    std::atomic<int64> totalSize{0};
+    std::atomic<bool> bSuccess{true};
+
+    ParallelForThreads(pakFilenames.Num(), options.NumThreads, [&](int32 containerIndex) {
+        TArray<FToolFileEntry> &files = filesByContainer[containerIndex];
+        auto visitor = [&](FToolFileEntry &&entry) {
+            if (findPaths.Num() > 0 && !findPaths.Contains(entry.Filename)) {
+                return;
             }
-            files += result.GetValue();
-        } else if (extension == TEXT("utoc")) {
-            auto result = ReadFileListFromToc(pakFilename, keyChain);
-            if (!result) {
-                return false;
+            totalSize += entry.CompressedSize;
+            if (options.bStream) {
+                PrintFileEntry(entry);
+            } else if (options.Top > 0) {
+                // Keep a min-heap of the largest entries, so memory stays bounded by the requested count
+                files.HeapPush(MoveTemp(entry), byCompressedSize);
+                if (files.Num() > options.Top) {
+                    files.HeapPopDiscard(byCompressedSize);
+                }
+            } else {
+                files.Add(MoveTemp(entry));
+            }
+        };
+
+        const FString &containerPath = pakFilenames[containerIndex];
+        if (!options.IndexCacheDir.IsEmpty()) {
+            const bool bCacheHit = options.FindPaths.Num() > 0 ? FindInCachedIndex(options.IndexCacheDir, containerPath, keyChain, options.FindPaths, visitor)
+                                                               : VisitCachedIndex(options.IndexCacheDir, containerPath, keyChain, visitor);
+            if (bCacheHit) {
+                return;
             }
-            files += result.GetValue();
-        } else {
-            UE_LOG(LogPakFile, Error, TEXT("Expected .pak or .utoc file but got '%s'"), *pakFilename);
-            return false;
         }
+
+        // Cache miss: read the container and keep a copy of its index for the next query
+        TArray<FToolFileEntry> cacheEntries;
+        FGuid encryptionKeyGuid;
+        const bool bContainerRead = VisitFilesInContainer(containerPath, keyChain, encryptionKeyGuid, [&](FToolFileEntry &&entry) {
+            if (!options.IndexCacheDir.IsEmpty()) {
+                cacheEntries.Add(entry);
+            }
+            visitor(MoveTemp(entry));
+        });
+        if (!bContainerRead) {
+            bSuccess = false;
+        } else if (!options.IndexCacheDir.IsEmpty()) {
+            WriteCachedIndex(options.IndexCacheDir, containerPath, encryptionKeyGuid, cacheEntries);
+        }
+    });
+
+    if (!bSuccess) {
+        return false;
     }
 
-    Algo::StableSort(files, [](const FToolFileEntry &a, const FToolFileEntry &b) { return a.CompressedSize > b.CompressedSize; });
+    if (!options.bStream) {
+        TArray<FToolFileEntry> files;
+        for (TArray<FToolFileEntry> &containerFiles : filesByContainer) {
+            files.Append(MoveTemp(containerFiles));
+        }
 
-    int64 totalSize = 0;
-    for (const FToolFileEntry &file : files) {
-        UE_LOG(LogPakFile, Display, TEXT("%s (%s) [Compression: %.02f%%]"), *file.Filename, *HumanSize(file.CompressedSize), 100.0 * file.CompressedSize / file.UncompressedSize);
-        totalSize += file.CompressedSize;
+        Algo::StableSort(files, [](const FToolFileEntry &a, const FToolFileEntry &b) { return a.CompressedSize > b.CompressedSize; });
+        if (options.Top > 0 && files.Num() > options.Top) {
+            files.SetNum(options.Top);
+        }
+
+        for (const FToolFileEntry &file : files) {
+            PrintFileEntry(file);
+        }
     }
 
     UE_LOG(LogPakFile, Display, TEXT("Total compressed data: %s"), *HumanSize(totalSize));
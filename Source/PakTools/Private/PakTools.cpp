@@ -9,23 +9,47 @@
 
 IMPLEMENT_APPLICATION(PakTools, "PakTools");
 
+#if PAKTOOLS_LITE
+// PakFileUtilities is not linked, only the keys file given with -CryptoKeys= is supported
+void LoadKeyChain(const TCHAR *CmdLine, FKeyChain &OutCryptoSettings) {
+    FString cryptoKeysFile;
+    if (FParse::Value(CmdLine, TEXT("CryptoKeys="), cryptoKeysFile)) {
+        KeyChainUtilities::LoadKeyChainFromFile(cryptoKeysFile, OutCryptoSettings);
+    }
+}
+#else
 // Defined in PakFileUtilities.cpp
 void LoadKeyChain(const TCHAR *CmdLine, FKeyChain &OutCryptoSettings);
+#endif
 
 INT32_MAIN_INT32_ARGC_TCHAR_ARGV() {
     FTaskTagScope scope(ETaskTag::EGameThread);
 
+    // Must happen before anything is logged, stdout only carries data when the extracted files are streamed to it or -Serve answers on it
+    uetools::ReserveStdoutForData(ArgC, ArgV);
+
     // start up the main loop
+    const double preInitStartTime = FPlatformTime::Seconds();
     GEngineLoop.PreInit(ArgC, ArgV, TEXT("-UseIoStore"));
+    UE_LOG(LogPakFile, Display, TEXT("PreInit took %f seconds"), FPlatformTime::Seconds() - preInitStartTime);
 
     const double startTime = FPlatformTime::Seconds();
 
+#if PAKTOOLS_BENCHMARK
+    const int32 result = uetools::RunPakToolsBenchmark(FCommandLine::Get()) ? 0 : 1;
+#else
     const int32 result = uetools::ExecutePakTools(FCommandLine::Get()) ? 0 : 1;
+#endif
 
     UE_LOG(LogPakFile, Display, TEXT("PakTools executed in %f seconds"), FPlatformTime::Seconds() - startTime);
 
     GLog->Flush();
 
+#if PAKTOOLS_LITE
+    // Everything was written and closed by the command, the orderly module shutdown would only add to the runtime
+    FPlatformMisc::RequestExitWithStatus(true, uint8(result));
+#endif
+
     RequestEngineExit(TEXT("PakTools Exiting"));
 
     FEngineLoop::AppPreExit();
@@ -36,6 +60,58 @@ INT32_MAIN_INT32_ARGC_TCHAR_ARGV() {
 }
 
 namespace uetools {
+bool ParseExtractOptions(const TCHAR *CmdLine, FExtractOptions &options) {
+    if (FParse::Value(CmdLine, TEXT("Threads="), options.NumThreads) && options.NumThreads <= 0) {
+        options.NumThreads = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+    }
+    FParse::Value(CmdLine, TEXT("BlockWindow="), options.BlockWindow);
+    FParse::Value(CmdLine, TEXT("InFlightMB="), options.InFlightMB);
+    FParse::Value(CmdLine, TEXT("Writers="), options.WriteThreads);
+    FParse::Value(CmdLine, TEXT("WriteBehindMB="), options.WriteBehindMB);
+    if (FParse::Value(CmdLine, TEXT("ExtractTo="), options.ExtractTo) && options.ExtractTo != TEXT("-")) {
+        options.ExtractTo = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), options.ExtractTo);
+    }
+    options.bSortByOffset = FParse::Param(CmdLine, TEXT("SortByOffset"));
+    options.bZeroCopy = !FParse::Param(CmdLine, TEXT("NoZeroCopy"));
+    options.bIncremental = FParse::Param(CmdLine, TEXT("Incremental"));
+    FString dedupMode;
+    if (FParse::Value(CmdLine, TEXT("Dedup="), dedupMode)) {
+        options.bDedup = true;
+        options.bDedupReflink = dedupMode == TEXT("Reflink");
+    } else {
+        options.bDedup = FParse::Param(CmdLine, TEXT("Dedup"));
+    }
+    if (FParse::Value(CmdLine, TEXT("Stats="), options.StatsFile)) {
+        options.StatsFile = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), options.StatsFile);
+    }
+
+    FString patterns;
+    if (FParse::Value(CmdLine, TEXT("Include="), patterns)) {
+        patterns.Replace(TEXT("\\"), TEXT("/")).ParseIntoArray(options.IncludePatterns, TEXT(";"));
+    }
+    if (FParse::Value(CmdLine, TEXT("Exclude="), patterns)) {
+        patterns.Replace(TEXT("\\"), TEXT("/")).ParseIntoArray(options.ExcludePatterns, TEXT(";"));
+    }
+
+    FString fileListPath;
+    if (FParse::Value(CmdLine, TEXT("FileList="), fileListPath)) {
+        fileListPath = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), fileListPath);
+        TArray<FString> lines;
+        if (!FFileHelper::LoadFileToStringArray(lines, *fileListPath)) {
+            UE_LOG(LogPakFile, Error, TEXT("Unable to read file list '%s'."), *fileListPath);
+            return false;
+        }
+        for (const FString &line : lines) {
+            const FString filename = GetFileWithoutInitialDots(line.TrimStartAndEnd().Replace(TEXT("\\"), TEXT("/")));
+            if (!filename.IsEmpty() && !filename.StartsWith(TEXT("#"))) {
+                options.FileList.Add(filename);
+            }
+        }
+    }
+
+    return true;
+}
+
 bool ExecutePakTools(const TCHAR *CmdLine) {
     // Parse CLI (see PakFileUtilities.cpp)
     TArray<FString> nonOptionArguments;
@@ -49,9 +125,11 @@ bool ExecutePakTools(const TCHAR *CmdLine) {
     // Print UE version
     UE_LOG(LogPakFile, Display, TEXT("Using Unreal Engine %s"), *FEngineVersion::Current().ToString(EVersionComponent::Patch));
 
+    const double keyChainStartTime = FPlatformTime::Seconds();
     FKeyChain KeyChain;
     LoadKeyChain(CmdLine, KeyChain);
     KeyChainUtilities::ApplyEncryptionKeys(KeyChain);
+    UE_LOG(LogPakFile, Display, TEXT("Loading the key chain took %f seconds"), FPlatformTime::Seconds() - keyChainStartTime);
 
     if (FParse::Param(CmdLine, TEXT("List"))) {
         if (nonOptionArguments.Num() == 0) {
@@ -59,21 +137,93 @@ bool ExecutePakTools(const TCHAR *CmdLine) {
             return false;
         }
 
-        return ListFilesInPak(nonOptionArguments, KeyChain);
+        FListOptions options;
+        FParse::Value(CmdLine, TEXT("Threads="), options.NumThreads);
+        FParse::Value(CmdLine, TEXT("Top="), options.Top);
+        options.bStream = FParse::Param(CmdLine, TEXT("Stream"));
+        if (FParse::Value(CmdLine, TEXT("IndexCache="), options.IndexCacheDir)) {
+            options.IndexCacheDir = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), options.IndexCacheDir);
+        }
+        FString findPaths;
+        if (FParse::Value(CmdLine, TEXT("Find="), findPaths)) {
+            findPaths.ParseIntoArray(options.FindPaths, TEXT(";"));
+        }
+
+        return ListFilesInPak(nonOptionArguments, KeyChain, options);
     }
 
     if (FParse::Param(CmdLine, TEXT("Extract"))) {
+        FExtractOptions options;
+        if (!ParseExtractOptions(CmdLine, options)) {
+            return false;
+        }
+
+        // The output directory is not needed when streaming to an archive
+        FString outputDir;
+        if (options.ExtractTo.IsEmpty() && nonOptionArguments.Num() > 0) {
+            outputDir = nonOptionArguments.Pop();
+        }
+        if (nonOptionArguments.Num() == 0) {
+            UE_LOG(LogPakFile, Error, TEXT("Incorrect arguments. Expected: -Extract <pak_or_utoc> ... <output_directory> or -Extract <pak_or_utoc> ... -ExtractTo=<tar|->"));
+            return false;
+        }
+
+        return ExtractFilesFromPak(KeyChain, nonOptionArguments, outputDir, options);
+    }
+
+    if (FParse::Param(CmdLine, TEXT("Verify"))) {
+        if (nonOptionArguments.Num() == 0) {
+            UE_LOG(LogPakFile, Error, TEXT("Incorrect arguments. Expected: -Verify <pak_or_utoc> ..."));
+            return false;
+        }
+
+        // Nothing is written, so verification uses every core unless told otherwise
+        FExtractOptions options;
+        options.NumThreads = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+        if (!ParseExtractOptions(CmdLine, options)) {
+            return false;
+        }
+        options.bZeroCopy = false;
+
+        return VerifyFilesInPak(nonOptionArguments, KeyChain, options);
+    }
+
+    if (FParse::Param(CmdLine, TEXT("Serve"))) {
+        if (nonOptionArguments.Num() == 0) {
+            UE_LOG(LogPakFile, Error, TEXT("Incorrect arguments. Expected: -Serve <pak_or_utoc> ..."));
+            return false;
+        }
+
+        FServeOptions options;
+        FParse::Value(CmdLine, TEXT("Threads="), options.NumThreads);
+        if (FParse::Value(CmdLine, TEXT("Socket="), options.SocketPath)) {
+            options.SocketPath = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), options.SocketPath);
+        }
+        return ServeContainers(nonOptionArguments, KeyChain, options);
+    }
+
+    if (FParse::Param(CmdLine, TEXT("Diff"))) {
         if (nonOptionArguments.Num() != 2) {
-            UE_LOG(LogPakFile, Error, TEXT("Incorrect arguments. Expected: -Extract <pak_or_utoc> <output_directory>"));
+            UE_LOG(LogPakFile, Error, TEXT("Incorrect arguments. Expected: -Diff <old_pak_or_utoc> <new_pak_or_utoc>"));
             return false;
         }
 
-        return ExtractFilesFromPak(KeyChain, nonOptionArguments[0], nonOptionArguments[1]);
+        int32 numThreads = 0;
+        FParse::Value(CmdLine, TEXT("Threads="), numThreads);
+        return DiffContainers(nonOptionArguments[0], nonOptionArguments[1], KeyChain, numThreads);
     }
 
     UE_LOG(LogPakFile, Error, TEXT("No command specified. Usage:"));
-    UE_LOG(LogPakFile, Error, TEXT("  PakTools -List <pak_or_utoc> ..."));
-    UE_LOG(LogPakFile, Error, TEXT("  PakTools -Extract <pak_or_utoc> <output_directory>"));
+    UE_LOG(LogPakFile, Error, TEXT("  PakTools -List <pak_or_utoc> ... [-Threads=N] [-Stream] [-Top=N] [-IndexCache=<dir>] [-Find=<path;...>]"));
+    UE_LOG(LogPakFile, Error, TEXT("  PakTools -Extract <pak_or_utoc> ... <output_directory> [-Threads=N] [-BlockWindow=N] [-InFlightMB=N] [-SortByOffset] [-NoZeroCopy]"));
+    UE_LOG(LogPakFile, Error, TEXT("                   [-Include=<pattern;...>] [-Exclude=<pattern;...>] [-FileList=<txt>] [-Incremental] [-Stats=<json>]"));
+    UE_LOG(LogPakFile, Error, TEXT("                   [-Writers=N] [-WriteBehindMB=N] [-Dedup[=Hardlink|Reflink]]"));
+    UE_LOG(LogPakFile, Error, TEXT("  PakTools -Extract <pak_or_utoc> ... -ExtractTo=<tar|-> [-BlockWindow=N] [-InFlightMB=N] [-Include=<pattern;...>] [-Exclude=<pattern;...>]"));
+    UE_LOG(LogPakFile, Error, TEXT("  PakTools -Verify <pak_or_utoc> ... [-Threads=N] [-BlockWindow=N] [-SortByOffset] [-Include=<pattern;...>] [-Exclude=<pattern;...>]"));
+    UE_LOG(LogPakFile, Error, TEXT("                  [-Stats=<json>]"));
+    UE_LOG(LogPakFile, Error, TEXT("  PakTools -Serve <pak_or_utoc> ... [-Threads=N] [-Socket=<path>]  (one JSON request per line: list, stat, read, range, shutdown)"));
+    UE_LOG(LogPakFile, Error, TEXT("  PakTools -Diff <old> <new> [-Threads=N]  (each side is a container, a directory of containers or a list separated by ';')"));
+    UE_LOG(LogPakFile, Error, TEXT("  -Include, -Exclude and -FileList paths start with the mount point without its initial dots (Game/Content/...), as the extracted files"));
 
     return true;
 }
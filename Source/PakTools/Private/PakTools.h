@@ -4,12 +4,224 @@
 #include "IPlatformFilePak.h"
 #include "IoDispatcher.h"
 #include "KeyChainUtilities.h"
+#include "Misc/SecureHash.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+// Set by PakToolsBenchmark.Target.cs, main() then runs the benchmark suite instead of the command line tool
+#ifndef PAKTOOLS_BENCHMARK
+#define PAKTOOLS_BENCHMARK 0
+#endif
+
+// Set by PakToolsLite.Target.cs: lean startup without PakFileUtilities, plugins or CoreUObject, and an immediate exit
+#ifndef PAKTOOLS_LITE
+#define PAKTOOLS_LITE 0
+#endif
 
 namespace uetools {
+struct FExtractOptions {
+    // Number of workers extracting pak entries, 1 keeps the serial path
+    int32 NumThreads = 1;
+    // Number of compression blocks decoded in parallel inside a single pak entry, 0 disables the pipelined path
+    int32 BlockWindow = 0;
+    // Budget of decompressed IoStore chunk data being read asynchronously before it is written, larger chunks are streamed by ranges within it
+    int32 InFlightMB = 256;
+    // Process entries in their physical order in the container and merge neighbouring pak entries into larger reads
+    bool bSortByOffset = false;
+    // Let the kernel copy stored (uncompressed, unencrypted) pak entries to the output, only implemented on Linux
+    bool bZeroCopy = true;
+    // Only extract paths matching one of the patterns or listed in FileList, minus the excluded ones. For pak and IoStore containers alike, paths start
+    // with the mount point without its initial dots ("Game/Content/..."), as the files are written in the output directory
+    TArray<FString> IncludePatterns;
+    TArray<FString> ExcludePatterns;
+    TArray<FString> FileList;
+    // Skip files recorded with the same size and hash in the manifest of the output directory
+    bool bIncremental = false;
+    // Write the time and bytes spent per stage, per compression method and the slowest entries to this JSON file
+    FString StatsFile;
+    // Number of threads writing the extracted files behind the workers, 0 (the default) writes them synchronously
+    int32 WriteThreads = 0;
+    // Budget of decoded data waiting for the write threads, the workers block when it is exceeded
+    int32 WriteBehindMB = 256;
+    // Stream the files into this tar archive instead of the output directory, "-" writes it to stdout
+    FString ExtractTo;
+    // Files whose stored hash and size match an already extracted file are linked to it instead of being decoded and written again
+    bool bDedup = false;
+    // Use copy-on-write clones instead of hardlinks, so the deduplicated files can be modified independently
+    bool bDedupReflink = false;
+};
+
+struct FToolFileEntry {
+    FString Filename;
+    int64 UncompressedSize = 0;
+    int64 CompressedSize = 0;
+    const TCHAR *Source; // "Pak" or "IoStore"
+    int64 Offset = 0;    // Offset of the entry (pak) or of its first compressed block (IoStore)
+    FString Hash;        // Stored hash as hex, empty when unknown
+    // Pak only: stored hashes cover the compressed and encrypted data, and delete records mark files removed by a patch
+    FName CompressionMethod;
+    bool bEncrypted = false;
+    bool bDeleteRecord = false;
+};
+
+using FToolFileEntryVisitor = TFunctionRef<void(FToolFileEntry &&)>;
+
+struct FListOptions {
+    // Number of containers opened and indexed at once, 0 uses every core
+    int32 NumThreads = 0;
+    // Print entries as they are read, without sorting them
+    bool bStream = false;
+    // Only print the N largest entries, 0 prints everything
+    int32 Top = 0;
+    // Directory of the on-disk index cache, empty disables it
+    FString IndexCacheDir;
+    // Only print these paths (as printed by -List), resolved with a lookup when the index is cached
+    TArray<FString> FindPaths;
+};
+
+struct FServeOptions {
+    // Threads handling the requests, 0 uses every core
+    int32 NumThreads = 0;
+    // Listen on this Unix socket instead of reading the requests from stdin
+    FString SocketPath;
+};
+
+// Size and stored hash of a file written by a previous extraction
+struct FExtractManifestRecord {
+    int64 Size = 0;
+    FString Hash;
+};
+
+// Extracted files by path relative to the output directory
+using FExtractManifest = TMap<FString, FExtractManifestRecord>;
+
+// Extraction work item: a pak entry and its path under the mount point (without its initial dots), as for the IoStore items
+struct FPakExtractItem {
+    FString Filename;
+    FPakEntry Entry;
+};
+
+// State owned by a single extraction worker, nothing in here is shared between threads
+struct FPakExtractWorker {
+    void *Buffer = nullptr;
+    uint8 *CompressionBuffer = nullptr;
+    int64 CompressionBufferSize = 0;
+    TArray64<uint8> RunBuffer;
+    int32 PakFileDescriptor = -1; // Used by the zero-copy path, -1 when unavailable
+
+    int32 FileErrors = 0;
+    int32 ExtractedFiles = 0;
+    int32 ZeroCopyFiles = 0;
+    int64 ExtractedBytes = 0;
+    double Seconds = 0;
+};
+
+struct FIoStoreExtractItem {
+    FString Filename;
+    FIoChunkId ChunkId;
+    uint64 Size = 0;
+    int32 PartitionIndex = 0;
+    uint64 OffsetOnDisk = 0;
+    uint64 CompressedSize = 0;
+    FIoChunkHash Hash;
+};
+
+// A container opened for extraction along with its work list
+struct FExtractContainer {
+    FString Path;
+    int32 PatchLevel = 0;
+    TRefCountPtr<FPakFile> Pak;
+    TUniquePtr<FIoStoreReader> IoStoreReader;
+    TArray<FPakExtractItem> PakItems;
+    TArray<FIoStoreExtractItem> IoStoreItems;
+    TArray<FString> DeletedFiles; // Delete records of a patch pak, they hide the entries of the lower priority containers
+};
+
+// SHA1 of the payload of a pak entry as stored in the pak (before decryption), which is what FPakEntry::Hash covers
+struct FPakEntryHasher {
+    explicit FPakEntryHasher(const FPakEntry &InEntry)
+        : Entry(InEntry)
+        , RemainingSize(InEntry.Size) {}
+
+    void Update(const uint8 *Data, int64 Size) {
+        const int64 SizeToHash = FMath::Clamp<int64>(Size, 0, RemainingSize);
+        Sha.Update(Data, SizeToHash);
+        RemainingSize -= SizeToHash;
+    }
+
+    bool Matches() {
+        uint8 Hash[sizeof(Entry.Hash)];
+        Sha.Final();
+        Sha.GetHash(Hash);
+        return RemainingSize == 0 && FMemory::Memcmp(Hash, Entry.Hash, sizeof(Hash)) == 0;
+    }
+
+    const FPakEntry &Entry;
+    FSHA1 Sha;
+    int64 RemainingSize;
+};
+
+// Processes one pak entry, pakReader is a reader of the pak file (bFromPakFile) or of a run of entries read in memory
+using FPakEntryProcessor = TFunctionRef<bool(FArchive &pakReader, bool bFromPakFile, const FPakExtractItem &item, FPakExtractWorker &worker)>;
+
+enum class EFileLinkResult : uint8 {
+    Linked, // Hardlink or clone, no data was written
+    Copied, // The filesystem could not link the files, the data was copied
+    Failed
+};
+
+constexpr int64 GCopyBufferSize = 8 * 1024 * 1024; // 8MB buffer for extracting
+constexpr int32 GPipelinedBlockThreshold = 4;       // Entries with fewer blocks are not worth the task overhead
+
 bool ExecutePakTools(const TCHAR *CmdLine);
-bool ListFilesInPak(const TArray<FString> &pakFiles, const FKeyChain &keyChain);
-bool ExtractFilesFromPak(const FKeyChain &keyChain, const FString &pakFile, const FString &outputDir);
+bool ParseExtractOptions(const TCHAR *CmdLine, FExtractOptions &options);
+bool RunPakToolsBenchmark(const TCHAR *CmdLine);
+void ReserveStdoutForData(int32 ArgC, TCHAR *ArgV[]);
+FArchive *CreateExtractToWriter(const FString &extractTo);
+bool ListFilesInPak(const TArray<FString> &pakFiles, const FKeyChain &keyChain, const FListOptions &options);
+bool ExtractFilesFromPak(const FKeyChain &keyChain, const TArray<FString> &pakFiles, const FString &outputDir, const FExtractOptions &options);
+bool VerifyFilesInPak(const TArray<FString> &pakFiles, const FKeyChain &keyChain, const FExtractOptions &options);
+bool ServeContainers(const TArray<FString> &pakFiles, const FKeyChain &keyChain, const FServeOptions &options);
+bool DiffContainers(const FString &oldContainers, const FString &newContainers, const FKeyChain &keyChain, int32 numThreads);
+TOptional<TArray<FToolFileEntry>> ReadFileListFromPak(const FString &pakFilename, const FKeyChain &keyChain);
+TOptional<TArray<FToolFileEntry>> ReadFileListFromToc(const FString &pakFilename, const FKeyChain &keyChain);
+FString HumanSize(int64 size);
 TRefCountPtr<FPakFile> OpenPakFile(const FString &pakFilename, const FKeyChain &keyChain);
 TUniquePtr<FIoStoreReader> CreateIoStoreReader(const FString &Path, const FKeyChain &KeyChain);
+FString GetContainerPath(const FString &path);
 FString GetFileWithoutInitialDots(const FString &filename);
+// Runs body for every index on at most numThreads workers, 0 lets the task graph use every core
+void ParallelForThreads(int32 num, int32 numThreads, TFunctionRef<void(int32)> body);
+// Converts a path under the mount point (without its initial dots) to a path relative to it, fails if the path is outside the mount point
+bool GetPathUnderMountPrefix(const FString &mountPrefix, const FString &path, FString &outRelativePath);
+bool HasPathFilters(const FExtractOptions &options);
+bool IsPathExcluded(const FString &path, const FExtractOptions &options);
+FString GetWildcardDirectory(const FString &pattern);
+void CollectPakItems(const FPakFile &pak, const FExtractOptions &options, TArray<FPakExtractItem> &outItems);
+void CollectIoStoreItems(const FIoStoreReader &ioStoreReader, const FExtractOptions &options, TArray<FIoStoreExtractItem> &outItems);
+FName GetIoStoreCompressionMethod(const FIoStoreReader &ioStoreReader);
+int32 GetPatchLevel(const FString &path);
+bool OpenExtractContainer(const FKeyChain &keyChain, const FString &path, const FExtractOptions &options, FExtractContainer &outContainer);
+void ResolveOverlay(TArray<FExtractContainer> &containers);
+void ProcessPakItems(const FPakFile &pak, TArray<FPakExtractItem> &items, const FExtractOptions &options, TArray<FPakExtractWorker> &workers, TArray<bool> &outSucceeded,
+                     FPakEntryProcessor processor);
+bool BufferedCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry &Entry, void *Buffer, int64 BufferSize, const FKeyChain &InKeyChain, FPakEntryHasher *Hasher = nullptr);
+bool UncompressCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry &Entry, uint8 *&PersistentBuffer, int64 &BufferSize, const FKeyChain &InKeyChain,
+                        const FPakFile &PakFile, FPakEntryHasher *Hasher = nullptr);
+bool PipelinedUncompressCopyFile(FArchive &Dest, FArchive &Source, const FPakEntry &Entry, const FKeyChain &InKeyChain, const FPakFile &PakFile, int32 WindowSize,
+                                 FPakEntryHasher *Hasher = nullptr);
+bool StreamIoStoreChunk(const FIoStoreReader &ioStoreReader, const FIoStoreExtractItem &item, uint64 maxInFlightBytes, FArchive &dest);
+bool ReadPakEntryHeader(const FPakFile &pak, FArchive &pakReader, const FPakExtractItem &item, FPakEntry &outEntryInfo);
+bool DecodePakEntry(FArchive &dest, FArchive &pakReader, const FPakFile &pak, const FPakExtractItem &item, FPakExtractWorker &worker, const FKeyChain &keyChain,
+                    const FExtractOptions &options, FPakEntryHasher *hasher = nullptr);
+FString GetPakEntryHash(const FPakEntry &entry);
+FString GetIoChunkHash(const FIoChunkHash &hash);
+// Extracted files are replaced, never written through: an earlier -Dedup run may have linked other files to them
+void UnlinkOutputFile(const FString &filename);
+FArchive *CreateOutputFileWriter(const FString &filename);
+EFileLinkResult LinkOrCopyFile(const FString &source, const FString &dest, bool bReflink);
+bool LoadExtractManifest(const FString &outputDir, FExtractManifest &outManifest);
+bool SaveExtractManifest(const FString &outputDir, const FExtractManifest &manifest);
+bool VisitCachedIndex(const FString &cacheDir, const FString &containerPath, const FKeyChain &keyChain, FToolFileEntryVisitor visitor);
+bool FindInCachedIndex(const FString &cacheDir, const FString &containerPath, const FKeyChain &keyChain, const TArray<FString> &paths, FToolFileEntryVisitor visitor);
+bool WriteCachedIndex(const FString &cacheDir, const FString &containerPath, const FGuid &encryptionKeyGuid, const TArray<FToolFileEntry> &entries);
 } // namespace uetools
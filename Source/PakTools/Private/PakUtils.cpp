@@ -1,6 +1,8 @@
-﻿#include "IPlatformFilePak.h"
+﻿#include "Async/ParallelFor.h"
+#include "IPlatformFilePak.h"
 #include "IoDispatcher.h"
 #include "KeyChainUtilities.h"
+#include "PakTools.h"
 #include "PlatformFileManager.h"
 
 namespace uetools {
@@ -40,6 +42,17 @@ TUniquePtr<FIoStoreReader> CreateIoStoreReader(const FString &Path, const FKeyCh
     }
 }
 
+// Relative paths are resolved against the launch directory like the other path options, then against the binaries directory as UnrealPak's GetPakPath
+// does (it lives in PakFileUtilities, which the lite target doesn't link)
+FString GetContainerPath(const FString &path) {
+    const FString launchDirPath = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), path);
+    if (IFileManager::Get().FileExists(*launchDirPath) || IFileManager::Get().DirectoryExists(*launchDirPath)) {
+        return launchDirPath;
+    }
+    const FString baseDirPath = FPaths::ConvertRelativePathToFull(path);
+    return IFileManager::Get().FileExists(*baseDirPath) || IFileManager::Get().DirectoryExists(*baseDirPath) ? baseDirPath : launchDirPath;
+}
+
 FString GetFileWithoutInitialDots(const FString &filename) {
     FString result = filename;
     while (result.StartsWith(TEXT(".")) || result.StartsWith(TEXT("/")) || result.StartsWith(TEXT("\\"))) {
@@ -48,4 +61,72 @@ FString GetFileWithoutInitialDots(const FString &filename) {
     return result;
 }
 
+void ParallelForThreads(int32 num, int32 numThreads, TFunctionRef<void(int32)> body) {
+    if (numThreads <= 0) {
+        ParallelFor(num, body, EParallelForFlags::Unbalanced);
+        return;
+    }
+
+    // Each worker pulls the next index, so no more than numThreads of them run at once
+    const int32 numWorkers = FMath::Clamp(numThreads, 1, FMath::Max(num, 1));
+    std::atomic<int32> nextIndex{0};
+    ParallelFor(
+        numWorkers,
+        [&](int32 workerIndex) {
+            for (int32 index = nextIndex++; index < num; index = nextIndex++) {
+                body(index);
+            }
+        },
+        numWorkers == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::Unbalanced);
+}
+
+bool GetPathUnderMountPrefix(const FString &mountPrefix, const FString &path, FString &outRelativePath) {
+    if (mountPrefix.IsEmpty()) {
+        outRelativePath = path;
+        return true;
+    }
+    if (path.StartsWith(mountPrefix / TEXT(""))) {
+        outRelativePath = path.RightChop((mountPrefix / TEXT("")).Len());
+        return true;
+    }
+    // A directory above the mount point covers the whole container
+    if ((mountPrefix / TEXT("")).StartsWith(path / TEXT(""))) {
+        outRelativePath.Reset();
+        return true;
+    }
+    return false;
+}
+
+bool HasPathFilters(const FExtractOptions &options) {
+    return options.IncludePatterns.Num() > 0 || options.FileList.Num() > 0;
+}
+
+bool IsPathExcluded(const FString &path, const FExtractOptions &options) {
+    for (const FString &pattern : options.ExcludePatterns) {
+        if (path.MatchesWildcard(pattern)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+FString GetWildcardDirectory(const FString &pattern) {
+    int32 wildcardIndex = INDEX_NONE;
+    for (int32 index = 0; index < pattern.Len(); index++) {
+        if (pattern[index] == TEXT('*') || pattern[index] == TEXT('?')) {
+            wildcardIndex = index;
+            break;
+        }
+    }
+    return FPaths::GetPath(wildcardIndex == INDEX_NONE ? pattern : pattern.Left(wildcardIndex));
+}
+
+FString GetPakEntryHash(const FPakEntry &entry) {
+    return BytesToHex(entry.Hash, sizeof(entry.Hash));
+}
+
+FString GetIoChunkHash(const FIoChunkHash &hash) {
+    return BytesToHex(reinterpret_cast<const uint8 *>(&hash), sizeof(FIoChunkHash));
+}
+
 } // namespace uetools
@@ -0,0 +1,602 @@
+﻿#include "Algo/BinarySearch.h"
+#include "Algo/Sort.h"
+#include "Async/Async.h"
+#include "Dom/JsonObject.h"
+#include "HAL/Event.h"
+#include "Misc/Base64.h"
+#include "Misc/QueuedThreadPool.h"
+#include "Misc/ScopeExit.h"
+#include "PakTools.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+#include <atomic>
+#include <iostream>
+#include <string>
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace uetools {
+constexpr int64 GMaxServeRangeSize = 64 * 1024 * 1024;  // Ranges are returned inline as base64, larger ones should be read to a file
+constexpr uint64 GServeStreamBudget = 64 * 1024 * 1024; // Decoded data in flight per read request
+
+// Entry of the merged file table, by index in the containers and their work lists
+struct FServeEntry {
+    int32 ContainerIndex = 0;
+    int32 ItemIndex = 0;
+};
+
+// Keeps the containers open with their merged index, the requests can be handled from any thread
+class FContainerServer {
+  public:
+    FContainerServer(const FKeyChain &InKeyChain, TArray<FExtractContainer> &&InContainers)
+        : KeyChain(InKeyChain)
+        , Containers(MoveTemp(InContainers)) {
+        for (int32 containerIndex = 0; containerIndex < Containers.Num(); containerIndex++) {
+            const FExtractContainer &container = Containers[containerIndex];
+            for (int32 itemIndex = 0; itemIndex < container.PakItems.Num(); itemIndex++) {
+                Entries.Add(container.PakItems[itemIndex].Filename, {containerIndex, itemIndex});
+            }
+            for (int32 itemIndex = 0; itemIndex < container.IoStoreItems.Num(); itemIndex++) {
+                Entries.Add(container.IoStoreItems[itemIndex].Filename, {containerIndex, itemIndex});
+            }
+        }
+        Entries.GenerateKeyArray(SortedPaths);
+        Algo::Sort(SortedPaths);
+    }
+
+    int32 GetNumEntries() const { return SortedPaths.Num(); }
+    bool IsShutdownRequested() const { return bShutdownRequested; }
+
+    static bool IsShutdownRequest(const FString &line) {
+        TSharedPtr<FJsonObject> request;
+        FString op;
+        return FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(line), request) && request.IsValid() && request->TryGetStringField(TEXT("op"), op) &&
+               op == TEXT("shutdown");
+    }
+
+    // Requests and responses are single line JSON objects, the "id" of the request is returned with its response
+    FString HandleRequest(const FString &line) {
+        TSharedRef<FJsonObject> response = MakeShared<FJsonObject>();
+        TSharedPtr<FJsonObject> request;
+        if (!FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(line), request) || !request.IsValid()) {
+            SetError(*response, TEXT("Invalid JSON request"));
+        } else {
+            if (TSharedPtr<FJsonValue> id = request->TryGetField(TEXT("id"))) {
+                response->SetField(TEXT("id"), id);
+            }
+
+            FString op;
+            request->TryGetStringField(TEXT("op"), op);
+            if (op == TEXT("list")) {
+                HandleList(*request, *response);
+            } else if (op == TEXT("stat")) {
+                HandleStat(*request, *response);
+            } else if (op == TEXT("read")) {
+                HandleRead(*request, *response);
+            } else if (op == TEXT("range")) {
+                HandleRange(*request, *response);
+            } else if (op == TEXT("shutdown")) {
+                bShutdownRequested = true;
+                response->SetBoolField(TEXT("ok"), true);
+            } else {
+                SetError(*response, FString::Printf(TEXT("Unknown op '%s'"), *op));
+            }
+        }
+
+        FString json;
+        FJsonSerializer::Serialize(response, TJsonWriterFactory<TCHAR, TCondensedJsonPrintPolicy<TCHAR>>::Create(&json));
+        return json;
+    }
+
+  private:
+    static void SetError(FJsonObject &response, const FString &error) {
+        response.SetBoolField(TEXT("ok"), false);
+        response.SetStringField(TEXT("error"), error);
+    }
+
+    const FServeEntry *FindEntry(const FJsonObject &request, FJsonObject &response) const {
+        FString path;
+        request.TryGetStringField(TEXT("path"), path);
+        path = GetFileWithoutInitialDots(path.Replace(TEXT("\\"), TEXT("/")));
+        const FServeEntry *entry = Entries.Find(path);
+        if (entry == nullptr) {
+            SetError(response, FString::Printf(TEXT("File '%s' not found"), *path));
+        }
+        return entry;
+    }
+
+    void SetEntryFields(const FServeEntry &entry, FJsonObject &object) const {
+        const FExtractContainer &container = Containers[entry.ContainerIndex];
+        if (container.Pak) {
+            const FPakExtractItem &item = container.PakItems[entry.ItemIndex];
+            object.SetStringField(TEXT("path"), item.Filename);
+            object.SetNumberField(TEXT("size"), double(item.Entry.UncompressedSize));
+            object.SetNumberField(TEXT("compressedSize"), double(item.Entry.Size));
+        } else {
+            const FIoStoreExtractItem &item = container.IoStoreItems[entry.ItemIndex];
+            object.SetStringField(TEXT("path"), item.Filename);
+            object.SetNumberField(TEXT("size"), double(item.Size));
+            object.SetNumberField(TEXT("compressedSize"), double(item.CompressedSize));
+        }
+    }
+
+    void HandleList(const FJsonObject &request, FJsonObject &response) const {
+        FString prefix;
+        request.TryGetStringField(TEXT("prefix"), prefix);
+        prefix = GetFileWithoutInitialDots(prefix.Replace(TEXT("\\"), TEXT("/")));
+        int32 limit = MAX_int32;
+        request.TryGetNumberField(TEXT("limit"), limit);
+
+        // The paths sharing a prefix are contiguous in the sorted table
+        TArray<TSharedPtr<FJsonValue>> files;
+        for (int32 pathIndex = Algo::LowerBound(SortedPaths, prefix); pathIndex < SortedPaths.Num() && files.Num() < limit; pathIndex++) {
+            if (!SortedPaths[pathIndex].StartsWith(prefix)) {
+                break;
+            }
+            TSharedRef<FJsonObject> file = MakeShared<FJsonObject>();
+            SetEntryFields(Entries.FindChecked(SortedPaths[pathIndex]), *file);
+            files.Add(MakeShared<FJsonValueObject>(file));
+        }
+
+        response.SetBoolField(TEXT("ok"), true);
+        response.SetArrayField(TEXT("files"), files);
+    }
+
+    void HandleStat(const FJsonObject &request, FJsonObject &response) const {
+        const FServeEntry *entry = FindEntry(request, response);
+        if (entry == nullptr) {
+            return;
+        }
+
+        const FExtractContainer &container = Containers[entry->ContainerIndex];
+        response.SetBoolField(TEXT("ok"), true);
+        SetEntryFields(*entry, response);
+        response.SetStringField(TEXT("container"), container.Path);
+        if (container.Pak) {
+            const FPakExtractItem &item = container.PakItems[entry->ItemIndex];
+            response.SetStringField(TEXT("source"), TEXT("Pak"));
+            response.SetStringField(TEXT("hash"), GetPakEntryHash(item.Entry));
+            response.SetStringField(TEXT("compressionMethod"), container.Pak->GetInfo().GetCompressionMethod(item.Entry.CompressionMethodIndex).ToString());
+            response.SetBoolField(TEXT("encrypted"), item.Entry.IsEncrypted());
+        } else {
+            const FIoStoreExtractItem &item = container.IoStoreItems[entry->ItemIndex];
+            response.SetStringField(TEXT("source"), TEXT("IoStore"));
+            response.SetStringField(TEXT("hash"), GetIoChunkHash(item.Hash));
+            response.SetStringField(TEXT("compressionMethod"), GetIoStoreCompressionMethod(*container.IoStoreReader).ToString());
+        }
+    }
+
+    // Decodes a whole pak entry, dest receives the decoded content
+    bool DecodePakItem(const FExtractContainer &container, const FPakExtractItem &item, FArchive &dest) const {
+        FPakExtractWorker worker;
+        if (item.Entry.CompressionMethodIndex == 0) {
+            worker.Buffer = FMemory::Malloc(GCopyBufferSize);
+        }
+        ON_SCOPE_EXIT {
+            FMemory::Free(worker.Buffer);
+            FMemory::Free(worker.CompressionBuffer);
+        };
+
+        // Readers come from the pool of the pak, so concurrent requests never share one
+        FSharedPakReader pakReader = container.Pak->GetSharedReader(nullptr);
+        FPakEntry entryInfo;
+        return ReadPakEntryHeader(*container.Pak, pakReader.GetArchive(), item, entryInfo) &&
+               DecodePakEntry(dest, pakReader.GetArchive(), *container.Pak, item, worker, KeyChain, FExtractOptions()) && !dest.IsError();
+    }
+
+    // Reads [offset, offset + size) of a pak entry, only the AES blocks or compression blocks overlapping the range are read and decoded
+    bool ReadPakRange(const FExtractContainer &container, const FPakExtractItem &item, int64 offset, int64 size, TArray64<uint8> &outData) const {
+        if (size <= 0) {
+            return true;
+        }
+
+        const FPakFile &pak = *container.Pak;
+        const FPakEntry &entry = item.Entry;
+        FSharedPakReader pakReader = pak.GetSharedReader(nullptr);
+        FPakEntry entryInfo;
+        if (!ReadPakEntryHeader(pak, pakReader.GetArchive(), item, entryInfo)) {
+            return false;
+        }
+        const int64 payloadStart = pakReader->Tell();
+
+        const FNamedAESKey *key = nullptr;
+        if (entry.IsEncrypted()) {
+            key = KeyChain.GetEncryptionKeys().Find(pak.GetInfo().EncryptionKeyGuid);
+            if (key == nullptr) {
+                key = KeyChain.GetPrincipalEncryptionKey();
+            }
+            if (key == nullptr) {
+                return false;
+            }
+        }
+
+        outData.SetNumUninitialized(size);
+        if (entry.CompressionMethodIndex == 0) {
+            if (key == nullptr) {
+                pakReader->Seek(payloadStart + offset);
+                pakReader->Serialize(outData.GetData(), size);
+                return !pakReader->IsError();
+            }
+
+            // AES blocks are decrypted independently, the range is widened to the blocks covering it
+            const int64 alignedStart = AlignDown(offset, FAES::AESBlockSize);
+            TArray64<uint8> encryptedData;
+            encryptedData.SetNumUninitialized(Align(offset + size, FAES::AESBlockSize) - alignedStart);
+            pakReader->Seek(payloadStart + alignedStart);
+            pakReader->Serialize(encryptedData.GetData(), encryptedData.Num());
+            FAES::DecryptData(encryptedData.GetData(), encryptedData.Num(), key->Key);
+            FMemory::Memcpy(outData.GetData(), encryptedData.GetData() + (offset - alignedStart), size);
+            return !pakReader->IsError();
+        }
+
+        const FName compressionMethod = pak.GetInfo().GetCompressionMethod(entry.CompressionMethodIndex);
+        const int64 blockSize = entry.CompressionBlockSize;
+        const int64 blockOffsetBase = pak.GetInfo().HasRelativeCompressedChunkOffsets() ? entry.Offset : 0;
+        TArray64<uint8> compressedData;
+        TArray64<uint8> uncompressedData;
+        uncompressedData.SetNumUninitialized(blockSize);
+        for (int64 blockIndex = offset / blockSize; blockIndex * blockSize < offset + size; blockIndex++) {
+            const FPakCompressedBlock &block = entry.CompressionBlocks[blockIndex];
+            const int64 compressedSize = block.CompressedEnd - block.CompressedStart;
+            const int64 blockStart = blockIndex * blockSize;
+            const int64 uncompressedSize = FMath::Min<int64>(entry.UncompressedSize - blockStart, blockSize);
+
+            compressedData.SetNumUninitialized(key ? Align(compressedSize, FAES::AESBlockSize) : compressedSize);
+            pakReader->Seek(block.CompressedStart + blockOffsetBase);
+            pakReader->Serialize(compressedData.GetData(), compressedData.Num());
+            if (pakReader->IsError()) {
+                return false;
+            }
+            if (key) {
+                FAES::DecryptData(compressedData.GetData(), compressedData.Num(), key->Key);
+            }
+            if (!FCompression::UncompressMemory(compressionMethod, uncompressedData.GetData(), IntCastChecked<int32>(uncompressedSize), compressedData.GetData(),
+                                                IntCastChecked<int32>(compressedSize))) {
+                return false;
+            }
+
+            const int64 copyStart = FMath::Max(offset, blockStart);
+            const int64 copyEnd = FMath::Min(offset + size, blockStart + uncompressedSize);
+            FMemory::Memcpy(outData.GetData() + (copyStart - offset), uncompressedData.GetData() + (copyStart - blockStart), copyEnd - copyStart);
+        }
+        return true;
+    }
+
+    void HandleRead(const FJsonObject &request, FJsonObject &response) const {
+        const FServeEntry *entry = FindEntry(request, response);
+        if (entry == nullptr) {
+            return;
+        }
+
+        FString dest;
+        if (!request.TryGetStringField(TEXT("dest"), dest) || dest.IsEmpty()) {
+            SetError(response, TEXT("Missing 'dest'"));
+            return;
+        }
+        dest = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), dest);
+
+        // Unlinked first like every output of the tool, so a file hardlinked or cloned by -Dedup is replaced instead of written through
+        const FExtractContainer &container = Containers[entry->ContainerIndex];
+        TUniquePtr<FArchive> writer(CreateOutputFileWriter(dest));
+        if (!writer) {
+            SetError(response, FString::Printf(TEXT("Unable to create file '%s'"), *dest));
+            return;
+        }
+
+        int64 size = 0;
+        FString error;
+        if (container.Pak) {
+            const FPakExtractItem &item = container.PakItems[entry->ItemIndex];
+            if (!DecodePakItem(container, item, *writer)) {
+                error = FString::Printf(TEXT("Unable to decode '%s'"), *item.Filename);
+            }
+            size = item.Entry.UncompressedSize;
+        } else {
+            // Streamed by ranges, concurrent reads of huge chunks don't hold them whole in memory
+            const FIoStoreExtractItem &item = container.IoStoreItems[entry->ItemIndex];
+            if (!StreamIoStoreChunk(*container.IoStoreReader, item, GServeStreamBudget, *writer)) {
+                error = FString::Printf(TEXT("Unable to read '%s'"), *item.Filename);
+            }
+            size = int64(item.Size);
+        }
+
+        if (!writer->Close() && error.IsEmpty()) {
+            error = FString::Printf(TEXT("Unable to write file '%s'"), *dest);
+        }
+        if (!error.IsEmpty()) {
+            // A partial file would look like a successful read
+            writer.Reset();
+            UnlinkOutputFile(dest);
+            SetError(response, error);
+            return;
+        }
+        response.SetBoolField(TEXT("ok"), true);
+        response.SetStringField(TEXT("dest"), dest);
+        response.SetNumberField(TEXT("size"), double(size));
+    }
+
+    void HandleRange(const FJsonObject &request, FJsonObject &response) const {
+        const FServeEntry *entry = FindEntry(request, response);
+        if (entry == nullptr) {
+            return;
+        }
+
+        int64 offset = 0;
+        int64 size = 0;
+        request.TryGetNumberField(TEXT("offset"), offset);
+        request.TryGetNumberField(TEXT("size"), size);
+        if (offset < 0 || size <= 0 || size > GMaxServeRangeSize) {
+            SetError(response, FString::Printf(TEXT("Invalid range, the size must be between 1 and %lld"), GMaxServeRangeSize));
+            return;
+        }
+
+        const FExtractContainer &container = Containers[entry->ContainerIndex];
+        TArray64<uint8> data;
+        if (container.Pak) {
+            const FPakExtractItem &item = container.PakItems[entry->ItemIndex];
+            size = FMath::Clamp<int64>(item.Entry.UncompressedSize - offset, 0, size);
+            if (!ReadPakRange(container, item, offset, size, data)) {
+                SetError(response, FString::Printf(TEXT("Unable to decode '%s'"), *item.Filename));
+                return;
+            }
+        } else {
+            // IoStore only decompresses the blocks overlapping the range
+            const FIoStoreExtractItem &item = container.IoStoreItems[entry->ItemIndex];
+            size = FMath::Clamp<int64>(int64(item.Size) - offset, 0, size);
+            if (size > 0) {
+                TIoStatusOr<FIoBuffer> buffer = container.IoStoreReader->Read(item.ChunkId, FIoReadOptions(uint64(offset), uint64(size)));
+                if (!buffer.IsOk()) {
+                    SetError(response, buffer.Status().ToString());
+                    return;
+                }
+                data.Append(buffer.ValueOrDie().Data(), int64(buffer.ValueOrDie().DataSize()));
+            }
+            size = data.Num();
+        }
+
+        response.SetBoolField(TEXT("ok"), true);
+        response.SetNumberField(TEXT("offset"), double(offset));
+        response.SetNumberField(TEXT("size"), double(size));
+        response.SetStringField(TEXT("data"), FBase64::Encode(data.GetData(), uint32(size)));
+    }
+
+    const FKeyChain &KeyChain;
+    TArray<FExtractContainer> Containers;
+    TMap<FString, FServeEntry> Entries;
+    TArray<FString> SortedPaths;
+    std::atomic<bool> bShutdownRequested{false};
+};
+
+// Reads request lines until the end of the stream, the pool handles them concurrently so responses may come out of order
+void ServeStream(FContainerServer &server, FQueuedThreadPool &pool, TFunctionRef<bool(std::string &)> readLine, TFunction<void(const FString &)> sendResponse) {
+    // Counts the reading loop itself until it ends, whoever brings it to zero triggers the event
+    std::atomic<int32> numPending{1};
+    FEventRef pendingDone;
+
+    std::string line;
+    while (!server.IsShutdownRequested() && readLine(line)) {
+        if (line.empty() || line == "\r") {
+            continue;
+        }
+
+        FString request(UTF8_TO_TCHAR(line.c_str()));
+        if (FContainerServer::IsShutdownRequest(request)) {
+            // Answered on the reading thread, which would otherwise block on the next line until the client closes the stream
+            sendResponse(server.HandleRequest(request));
+            break;
+        }
+
+        numPending++;
+        AsyncPool(pool, [&, request = MoveTemp(request)] {
+            sendResponse(server.HandleRequest(request));
+            if (--numPending == 0) {
+                pendingDone->Trigger();
+            }
+        });
+    }
+
+    if (--numPending != 0) {
+        pendingDone->Wait();
+    }
+}
+
+// Responses are written whole under the lock, so the lines of concurrent requests never interleave
+void WriteResponse(FArchive &output, FCriticalSection &outputLock, const FString &response) {
+    FTCHARToUTF8 utf8(*response);
+    FScopeLock lock(&outputLock);
+    output.Serialize(const_cast<ANSICHAR *>(utf8.Get()), utf8.Length());
+    output.Serialize(const_cast<ANSICHAR *>("\n"), 1);
+}
+
+bool ServeStdin(FContainerServer &server, FQueuedThreadPool &pool) {
+    TUniquePtr<FArchive> output(CreateExtractToWriter(TEXT("-")));
+    if (!output) {
+        return false;
+    }
+
+    UE_LOG(LogPakFile, Display, TEXT("Serving %d files on stdin"), server.GetNumEntries());
+    FCriticalSection outputLock;
+    ServeStream(
+        server, pool, [](std::string &line) { return bool(std::getline(std::cin, line)); },
+        [&](const FString &response) { WriteResponse(*output, outputLock, response); });
+    return true;
+}
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+class FSocketWriter : public FArchive {
+  public:
+    explicit FSocketWriter(int InSocket)
+        : Socket(InSocket) {
+        SetIsSaving(true);
+    }
+
+    virtual void Serialize(void *V, int64 Length) override {
+        const uint8 *data = static_cast<const uint8 *>(V);
+        while (Length > 0 && !IsError()) {
+#ifdef MSG_NOSIGNAL
+            const ssize_t sentSize = send(Socket, data, size_t(Length), MSG_NOSIGNAL);
+#else
+            const ssize_t sentSize = send(Socket, data, size_t(Length), 0);
+#endif
+            if (sentSize < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sentSize <= 0) {
+                SetError();
+                return;
+            }
+            data += sentSize;
+            Length -= sentSize;
+        }
+    }
+
+    virtual FString GetArchiveName() const override { return TEXT("FSocketWriter"); }
+
+  private:
+    int Socket;
+};
+
+// onShutdown is called once the response of a shutdown request is sent, to wake up the threads blocked on the sockets
+void ServeConnection(FContainerServer &server, FQueuedThreadPool &pool, int connection, TFunctionRef<void()> onShutdown) {
+    FSocketWriter output(connection);
+    FCriticalSection outputLock;
+    std::string pending;
+    ServeStream(
+        server, pool,
+        [&](std::string &line) {
+            for (;;) {
+                const size_t lineEnd = pending.find('\n');
+                if (lineEnd != std::string::npos) {
+                    line = pending.substr(0, lineEnd);
+                    pending.erase(0, lineEnd + 1);
+                    return true;
+                }
+                char buffer[64 * 1024];
+                const ssize_t readSize = read(connection, buffer, sizeof(buffer));
+                if (readSize < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (readSize <= 0) {
+                    return false;
+                }
+                pending.append(buffer, size_t(readSize));
+            }
+        },
+        [&](const FString &response) {
+            WriteResponse(output, outputLock, response);
+            if (server.IsShutdownRequested()) {
+                onShutdown();
+            }
+        });
+}
+
+bool ServeSocket(FContainerServer &server, FQueuedThreadPool &pool, const FString &socketPath) {
+    const FTCHARToUTF8 utf8Path(*socketPath);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (size_t(utf8Path.Length()) >= sizeof(address.sun_path)) {
+        UE_LOG(LogPakFile, Error, TEXT("Socket path '%s' is too long."), *socketPath);
+        return false;
+    }
+    FMemory::Memcpy(address.sun_path, utf8Path.Get(), utf8Path.Length());
+
+    const int listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket < 0) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to create socket (%d)."), errno);
+        return false;
+    }
+    ON_SCOPE_EXIT {
+        close(listenSocket);
+        unlink(utf8Path.Get());
+    };
+
+    // A socket file left by a previous server would make bind fail
+    unlink(utf8Path.Get());
+    if (bind(listenSocket, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 || listen(listenSocket, SOMAXCONN) != 0) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to listen on '%s' (%d)."), *socketPath, errno);
+        return false;
+    }
+
+    UE_LOG(LogPakFile, Display, TEXT("Serving %d files on %s"), server.GetNumEntries(), *socketPath);
+
+    // Each connection reads its requests on its own thread and shares the pool with the others
+    FCriticalSection connectionsLock;
+    TSet<int> openConnections;
+    TArray<TFuture<void>> connectionThreads;
+    auto wakeUpAll = [&] {
+        FScopeLock lock(&connectionsLock);
+        shutdown(listenSocket, SHUT_RDWR);
+        for (const int connection : openConnections) {
+            shutdown(connection, SHUT_RDWR);
+        }
+    };
+    while (!server.IsShutdownRequested()) {
+        const int connection = accept(listenSocket, nullptr, nullptr);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+
+        FScopeLock lock(&connectionsLock);
+        openConnections.Add(connection);
+        connectionThreads.Add(Async(EAsyncExecution::Thread, [&, connection] {
+            ServeConnection(server, pool, connection, wakeUpAll);
+
+            // Closed under the lock, so the descriptor is not reused by accept while it is still in the set
+            FScopeLock lock(&connectionsLock);
+            openConnections.Remove(connection);
+            close(connection);
+        }));
+    }
+
+    for (TFuture<void> &connectionThread : connectionThreads) {
+        connectionThread.Wait();
+    }
+    return true;
+}
+#endif
+
+bool ServeContainers(const TArray<FString> &pakFiles, const FKeyChain &keyChain, const FServeOptions &options) {
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_ServeContainers);
+    const double startTime = FPlatformTime::Seconds();
+
+    // Paths are always under the mount point, so they don't change when containers are added
+    TArray<FExtractContainer> containers;
+    containers.SetNum(pakFiles.Num());
+    for (int32 containerIndex = 0; containerIndex < pakFiles.Num(); containerIndex++) {
+        const FString absolutePakFile = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), pakFiles[containerIndex]);
+        if (!OpenExtractContainer(keyChain, absolutePakFile, FExtractOptions(), containers[containerIndex])) {
+            return false;
+        }
+    }
+    if (containers.Num() > 1) {
+        ResolveOverlay(containers);
+    }
+
+    FContainerServer server(keyChain, MoveTemp(containers));
+    UE_LOG(LogPakFile, Display, TEXT("Indexed %d files in %.2f seconds"), server.GetNumEntries(), FPlatformTime::Seconds() - startTime);
+
+    const int32 numThreads = options.NumThreads > 0 ? options.NumThreads : FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+    TUniquePtr<FQueuedThreadPool> pool(FQueuedThreadPool::Allocate());
+    pool->Create(numThreads, 256 * 1024, TPri_Normal, TEXT("PakToolsServe"));
+    ON_SCOPE_EXIT { pool->Destroy(); };
+
+    if (options.SocketPath.IsEmpty()) {
+        return ServeStdin(server, *pool);
+    }
+#if PLATFORM_LINUX || PLATFORM_MAC
+    return ServeSocket(server, *pool, options.SocketPath);
+#else
+    UE_LOG(LogPakFile, Error, TEXT("-Socket is only supported on Linux and Mac, requests can be sent on stdin instead."));
+    return false;
+#endif
+}
+} // namespace uetools
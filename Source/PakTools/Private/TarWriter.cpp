@@ -0,0 +1,244 @@
+﻿#include "PakTools.h"
+#include "TarWriter.h"
+
+#include <string>
+
+#if PLATFORM_WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+namespace uetools {
+// Descriptor of the original stdout once it is reserved for data, -1 otherwise
+static int32 GStdoutDataDescriptor = -1;
+
+void ReserveStdoutForData(int32 ArgC, TCHAR *ArgV[]) {
+    // Streamed archives and the responses of -Serve when it is not given a socket
+    bool bStdoutRequested = false;
+    bool bServe = false;
+    bool bSocket = false;
+    for (int32 argIndex = 1; argIndex < ArgC; argIndex++) {
+        bStdoutRequested |= FCString::Stricmp(ArgV[argIndex], TEXT("-ExtractTo=-")) == 0;
+        bServe |= FCString::Stricmp(ArgV[argIndex], TEXT("-Serve")) == 0;
+        bSocket |= FCString::Strnicmp(ArgV[argIndex], TEXT("-Socket="), 8) == 0;
+    }
+    if (!bStdoutRequested && !(bServe && !bSocket)) {
+        return;
+    }
+
+    // Keep the original stdout for the data and point the standard output at stderr, so everything logged from now on stays out of the stream
+    fflush(stdout);
+#if PLATFORM_WINDOWS
+    GStdoutDataDescriptor = _dup(_fileno(stdout));
+    _setmode(GStdoutDataDescriptor, _O_BINARY);
+    _dup2(_fileno(stderr), _fileno(stdout));
+#else
+    GStdoutDataDescriptor = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+#endif
+}
+
+class FStdoutWriter : public FArchive {
+  public:
+    explicit FStdoutWriter(int32 InDescriptor)
+        : Descriptor(InDescriptor) {
+        SetIsSaving(true);
+    }
+
+    virtual void Serialize(void *V, int64 Length) override {
+        const uint8 *data = static_cast<const uint8 *>(V);
+        while (Length > 0 && !IsError()) {
+#if PLATFORM_WINDOWS
+            const int64 writtenSize = _write(Descriptor, data, uint32(FMath::Min<int64>(Length, MAX_int32)));
+#else
+            const int64 writtenSize = write(Descriptor, data, size_t(Length));
+            if (writtenSize < 0 && errno == EINTR) {
+                continue;
+            }
+#endif
+            if (writtenSize <= 0) {
+                SetError();
+                return;
+            }
+            data += writtenSize;
+            Length -= writtenSize;
+            Pos += writtenSize;
+        }
+    }
+
+    virtual int64 Tell() override { return Pos; }
+    virtual FString GetArchiveName() const override { return TEXT("FStdoutWriter"); }
+
+  private:
+    int32 Descriptor;
+    int64 Pos = 0;
+};
+
+FArchive *CreateExtractToWriter(const FString &extractTo) {
+    if (extractTo != TEXT("-")) {
+        return IFileManager::Get().CreateFileWriter(*extractTo);
+    }
+    if (GStdoutDataDescriptor < 0) {
+        UE_LOG(LogPakFile, Error, TEXT("Stdout was not reserved for the extracted data."));
+        return nullptr;
+    }
+    return new FStdoutWriter(GStdoutDataDescriptor);
+}
+
+struct FTarHeader {
+    ANSICHAR Name[100];
+    ANSICHAR Mode[8];
+    ANSICHAR Uid[8];
+    ANSICHAR Gid[8];
+    ANSICHAR Size[12];
+    ANSICHAR ModificationTime[12];
+    ANSICHAR Checksum[8];
+    ANSICHAR TypeFlag;
+    ANSICHAR LinkName[100];
+    ANSICHAR Magic[6];
+    ANSICHAR Version[2];
+    ANSICHAR UserName[32];
+    ANSICHAR GroupName[32];
+    ANSICHAR DeviceMajor[8];
+    ANSICHAR DeviceMinor[8];
+    ANSICHAR Prefix[155];
+    ANSICHAR Padding[12];
+};
+static_assert(sizeof(FTarHeader) == 512, "Tar headers are 512 bytes");
+
+constexpr int64 GTarBlockSize = 512;
+constexpr int64 GMaxTarOctalSize = 077777777777; // Largest size that fits the 11 digits of the header, larger files get a pax record
+
+// Fills the field with fieldSize - 1 octal digits and a terminating null
+void WriteTarOctal(ANSICHAR *field, int32 fieldSize, int64 value) {
+    for (int32 index = fieldSize - 2; index >= 0; index--) {
+        field[index] = ANSICHAR('0' + (value & 7));
+        value >>= 3;
+    }
+    field[fieldSize - 1] = '\0';
+}
+
+// Pax records are "<length> <key>=<value>\n", the length includes its own digits
+std::string MakePaxRecord(const std::string &key, const std::string &value) {
+    const size_t contentSize = 1 + key.size() + 1 + value.size() + 1;
+    size_t recordSize = contentSize + 1;
+    while (recordSize != contentSize + std::to_string(recordSize).size()) {
+        recordSize = contentSize + std::to_string(recordSize).size();
+    }
+    return std::to_string(recordSize) + " " + key + "=" + value + "\n";
+}
+
+FTarWriter::FTarWriter(FArchive *InOutput, int64 InModificationTime)
+    : Output(InOutput)
+    , ModificationTime(InModificationTime) {
+    SetIsSaving(true);
+}
+
+FTarWriter::~FTarWriter() = default;
+
+void FTarWriter::WriteHeader(const std::string &name, const std::string &prefix, int64 size, ANSICHAR typeFlag) {
+    FTarHeader header;
+    FMemory::Memzero(header);
+    FMemory::Memcpy(header.Name, name.data(), FMath::Min(name.size(), sizeof(header.Name)));
+    FMemory::Memcpy(header.Prefix, prefix.data(), FMath::Min(prefix.size(), sizeof(header.Prefix)));
+    WriteTarOctal(header.Mode, sizeof(header.Mode), 0644);
+    WriteTarOctal(header.Uid, sizeof(header.Uid), 0);
+    WriteTarOctal(header.Gid, sizeof(header.Gid), 0);
+    WriteTarOctal(header.Size, sizeof(header.Size), FMath::Min(size, GMaxTarOctalSize));
+    WriteTarOctal(header.ModificationTime, sizeof(header.ModificationTime), ModificationTime);
+    header.TypeFlag = typeFlag;
+    FMemory::Memcpy(header.Magic, "ustar", 6);
+    FMemory::Memcpy(header.Version, "00", 2);
+
+    // The checksum is computed with its own field filled with spaces
+    FMemory::Memset(header.Checksum, ' ', sizeof(header.Checksum));
+    uint32 checksum = 0;
+    for (const uint8 byte : TArrayView<const uint8>(reinterpret_cast<const uint8 *>(&header), sizeof(header))) {
+        checksum += byte;
+    }
+    WriteTarOctal(header.Checksum, 7, checksum);
+
+    Output->Serialize(&header, sizeof(header));
+}
+
+void FTarWriter::WritePadding(int64 size) {
+    static const uint8 Zeros[GTarBlockSize] = {};
+    const int64 paddingSize = (GTarBlockSize - size % GTarBlockSize) % GTarBlockSize;
+    Output->Serialize(const_cast<uint8 *>(Zeros), paddingSize);
+}
+
+bool FTarWriter::BeginFile(const FString &path, int64 size) {
+    check(!bInFile);
+    const FTCHARToUTF8 utf8Converter(*path);
+    const std::string utf8Path(utf8Converter.Get(), utf8Converter.Length());
+
+    // Paths up to 255 bytes fit the name and prefix fields when they can be split on a separator, longer ones go to a pax record
+    std::string name = utf8Path;
+    std::string prefix;
+    bool bNeedsPax = size > GMaxTarOctalSize;
+    if (utf8Path.size() > 100) {
+        const size_t firstSeparator = utf8Path.find('/', utf8Path.size() - 101);
+        if (firstSeparator != std::string::npos && firstSeparator > 0 && firstSeparator <= 155 && firstSeparator < utf8Path.size() - 1) {
+            prefix = utf8Path.substr(0, firstSeparator);
+            name = utf8Path.substr(firstSeparator + 1);
+        } else {
+            name = utf8Path.substr(utf8Path.size() - 100);
+            bNeedsPax = true;
+        }
+    }
+
+    if (bNeedsPax) {
+        std::string records = MakePaxRecord("path", utf8Path);
+        if (size > GMaxTarOctalSize) {
+            records += MakePaxRecord("size", std::to_string(size));
+        }
+        WriteHeader("PaxHeader", std::string(), int64(records.size()), 'x');
+        Output->Serialize(records.data(), int64(records.size()));
+        WritePadding(int64(records.size()));
+    }
+
+    WriteHeader(name, prefix, size, '0');
+    FileSize = size;
+    FileWritten = 0;
+    bInFile = true;
+    return !Output->IsError();
+}
+
+void FTarWriter::Serialize(void *V, int64 Length) {
+    check(bInFile);
+    if (FileWritten + Length > FileSize) {
+        // More data than announced in the header would corrupt the stream
+        SetError();
+        Length = FileSize - FileWritten;
+    }
+    Output->Serialize(V, Length);
+    FileWritten += Length;
+}
+
+bool FTarWriter::EndFile() {
+    check(bInFile);
+    const bool bComplete = FileWritten == FileSize && !IsError();
+
+    // Entries that failed midway are completed with zeros, the header already announced their size
+    static const uint8 Zeros[GTarBlockSize] = {};
+    for (int64 remainingSize = FileSize - FileWritten; remainingSize > 0; remainingSize -= GTarBlockSize) {
+        Output->Serialize(const_cast<uint8 *>(Zeros), FMath::Min(remainingSize, GTarBlockSize));
+    }
+    WritePadding(FileSize);
+
+    ClearError();
+    bInFile = false;
+    return bComplete && !Output->IsError();
+}
+
+bool FTarWriter::Finish() {
+    check(!bInFile);
+    static const uint8 Zeros[GTarBlockSize * 2] = {};
+    Output->Serialize(const_cast<uint8 *>(Zeros), sizeof(Zeros));
+    Output->Flush();
+    return Output->Close() && !Output->IsError();
+}
+} // namespace uetools
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include <string>
+
+namespace uetools {
+// Streams files into a tar archive (ustar, with pax records for long paths and large files). The size of each file is written in its header, so it
+// must be known before its data, which is then serialized into the writer.
+class FTarWriter : public FArchive {
+  public:
+    FTarWriter(FArchive *InOutput, int64 InModificationTime);
+    virtual ~FTarWriter() override;
+
+    bool BeginFile(const FString &path, int64 size);
+    // Completes the file with zeros if less data than announced was written, returns false in that case
+    bool EndFile();
+    // Writes the end of archive marker and closes the output
+    bool Finish();
+
+    virtual void Serialize(void *V, int64 Length) override;
+    virtual FString GetArchiveName() const override { return TEXT("FTarWriter"); }
+
+  private:
+    void WriteHeader(const std::string &name, const std::string &prefix, int64 size, ANSICHAR typeFlag);
+    void WritePadding(int64 size);
+
+    TUniquePtr<FArchive> Output;
+    int64 ModificationTime;
+    int64 FileSize = 0;
+    int64 FileWritten = 0;
+    bool bInFile = false;
+};
+} // namespace uetools
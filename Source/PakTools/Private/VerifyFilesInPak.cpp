@@ -0,0 +1,177 @@
+﻿#include "ExtractStats.h"
+#include "Hash/Blake3.h"
+#include "IO/IoHash.h"
+#include "IPlatformFilePak.h"
+#include "KeyChainUtilities.h"
+#include "Misc/ScopeExit.h"
+#include "PakTools.h"
+
+#include <atomic>
+
+namespace uetools {
+// Destination of the copy functions when verifying, decoded data is only counted
+class FVerifyArchive : public FArchive {
+  public:
+    FVerifyArchive() { SetIsSaving(true); }
+
+    virtual void Serialize(void *V, int64 Length) override { Size += Length; }
+    virtual int64 Tell() override { return Size; }
+    virtual int64 TotalSize() override { return Size; }
+    virtual FString GetArchiveName() const override { return TEXT("FVerifyArchive"); }
+
+    int64 Size = 0;
+};
+
+// Destination of the streamed IoStore chunks, hashes them incrementally the same way as FIoChunkHash::HashBuffer
+class FIoChunkHashArchive : public FArchive {
+  public:
+    FIoChunkHashArchive() { SetIsSaving(true); }
+
+    virtual void Serialize(void *V, int64 Length) override {
+        Hasher.Update(V, uint64(Length));
+        Size += Length;
+    }
+    virtual FString GetArchiveName() const override { return TEXT("FIoChunkHashArchive"); }
+
+    FIoChunkHash GetHash() const { return FIoChunkHash::CreateFromIoHash(FIoHash(Hasher.Finalize())); }
+
+    FBlake3 Hasher;
+    int64 Size = 0;
+};
+
+// Runs the same read, decrypt and decompress path as the extraction and checks the stored hash of the entry
+bool VerifyPakEntry(const FPakFile &pak, FArchive &pakReader, const FPakExtractItem &item, FPakExtractWorker &worker, const FKeyChain &keyChain, const FExtractOptions &options) {
+    FExtractEntryScope entryScope(item.Filename, pak.GetInfo().GetCompressionMethod(item.Entry.CompressionMethodIndex), item.Entry.Size, item.Entry.UncompressedSize);
+    FPakEntry EntryInfo;
+    if (!ReadPakEntryHeader(pak, pakReader, item, EntryInfo)) {
+        return false;
+    }
+
+    FVerifyArchive decoded;
+    FPakEntryHasher hasher(item.Entry);
+    const bool bDecoded = DecodePakEntry(decoded, pakReader, pak, item, worker, keyChain, options, &hasher);
+    if (!bDecoded || pakReader.IsError() || decoded.Size != item.Entry.UncompressedSize) {
+        UE_LOG(LogPakFile, Error, TEXT("Unable to decode \"%s\"."), *item.Filename);
+        return false;
+    }
+    if (!hasher.Matches()) {
+        UE_LOG(LogPakFile, Error, TEXT("Hash mismatch for \"%s\"."), *item.Filename);
+        return false;
+    }
+
+    worker.ExtractedBytes += item.Entry.UncompressedSize;
+    return true;
+}
+
+bool VerifyPakContainer(const FKeyChain &keyChain, const FString &pakFile, const FExtractOptions &options, int32 &outFiles, int32 &outCorruptFiles, int64 &outBytes) {
+    const auto pak = OpenPakFile(pakFile, keyChain);
+    if (!pak) {
+        return false;
+    }
+
+    if (!pak->HasFilenames()) {
+        UE_LOG(LogPakFile, Error, TEXT("PakFiles were loaded without filenames, cannot verify."));
+        return false;
+    }
+
+    TArray<FPakExtractItem> items;
+    CollectPakItems(*pak, options, items);
+
+    TArray<FPakExtractWorker> workers;
+    workers.SetNum(FMath::Clamp(options.NumThreads, 1, FMath::Max(items.Num(), 1)));
+
+    TArray<bool> verifiedItems;
+    ProcessPakItems(*pak, items, options, workers, verifiedItems,
+                    [&](FArchive &pakReader, bool bFromPakFile, const FPakExtractItem &item, FPakExtractWorker &worker) {
+                        return VerifyPakEntry(*pak, pakReader, item, worker, keyChain, options);
+                    });
+
+    for (const FPakExtractWorker &worker : workers) {
+        outFiles += worker.ExtractedFiles + worker.FileErrors;
+        outCorruptFiles += worker.FileErrors;
+        outBytes += worker.ExtractedBytes;
+    }
+    return true;
+}
+
+bool VerifyIoStoreContainer(const FKeyChain &keyChain, const FString &pakFile, const FExtractOptions &options, int32 &outFiles, int32 &outCorruptFiles, int64 &outBytes) {
+    auto ioStoreReader = CreateIoStoreReader(pakFile, keyChain);
+    if (!ioStoreReader) {
+        return false;
+    }
+
+    TArray<FIoStoreExtractItem> items;
+    CollectIoStoreItems(*ioStoreReader, options, items);
+    const FName compressionMethod = GetIoStoreCompressionMethod(*ioStoreReader);
+
+    // The reader decrypts and decompresses the chunk, the stored hash covers the decompressed data. Chunks are streamed by ranges, the budget is shared by the
+    // workers
+    const uint64 maxInFlightBytes = uint64(FMath::Max(options.InFlightMB, 0)) * 1024 * 1024 / uint64(FMath::Max(options.NumThreads, 1));
+    std::atomic<int32> corruptFiles{0};
+    std::atomic<int64> verifiedBytes{0};
+    ParallelForThreads(items.Num(), options.NumThreads, [&](int32 itemIndex) {
+        const FIoStoreExtractItem &item = items[itemIndex];
+        FExtractEntryScope entryScope(item.Filename, item.CompressedSize < item.Size ? compressionMethod : NAME_None, int64(item.CompressedSize), int64(item.Size));
+        FIoChunkHashArchive hasher;
+        if (!StreamIoStoreChunk(*ioStoreReader, item, maxInFlightBytes, hasher)) {
+            corruptFiles++;
+            return;
+        }
+
+        if (uint64(hasher.Size) != item.Size || hasher.GetHash() != item.Hash) {
+            UE_LOG(LogPakFile, Error, TEXT("Hash mismatch for \"%s\"."), *item.Filename);
+            corruptFiles++;
+            return;
+        }
+        verifiedBytes += hasher.Size;
+    });
+
+    outFiles += items.Num();
+    outCorruptFiles += corruptFiles;
+    outBytes += verifiedBytes;
+    return true;
+}
+
+bool VerifyFilesInPak(const TArray<FString> &pakFiles, const FKeyChain &keyChain, const FExtractOptions &options) {
+    TRACE_CPUPROFILER_EVENT_SCOPE(PakTools_VerifyFilesInPak);
+    const double startTime = FPlatformTime::Seconds();
+    BeginExtractStats(options);
+    ON_SCOPE_EXIT { EndExtractStats(options, FPlatformTime::Seconds() - startTime); };
+    int32 files = 0;
+    int32 corruptFiles = 0;
+    int64 bytes = 0;
+    bool bSuccess = true;
+
+    for (const FString &pakFile : pakFiles) {
+        const FString absolutePakFile = FPaths::ConvertRelativePathToFull(FGenericPlatformMisc::LaunchDir(), pakFile);
+        UE_LOG(LogPakFile, Display, TEXT("Verifying files in %s"), *absolutePakFile);
+
+        if (!FPaths::FileExists(absolutePakFile)) {
+            UE_LOG(LogPakFile, Error, TEXT("Pak file '%s' does not exist."), *absolutePakFile);
+            bSuccess = false;
+            continue;
+        }
+
+        const FString extension = FPaths::GetExtension(absolutePakFile);
+        if (extension == TEXT("pak")) {
+            bSuccess &= VerifyPakContainer(keyChain, absolutePakFile, options, files, corruptFiles, bytes);
+        } else if (extension == TEXT("utoc")) {
+            bSuccess &= VerifyIoStoreContainer(keyChain, absolutePakFile, options, files, corruptFiles, bytes);
+        } else {
+            UE_LOG(LogPakFile, Error, TEXT("Expected .pak or .utoc file but got '%s'"), *absolutePakFile);
+            bSuccess = false;
+        }
+    }
+
+    const double seconds = FPlatformTime::Seconds() - startTime;
+    const double gigabytes = bytes / 1024.0 / 1024.0 / 1024.0;
+    UE_LOG(LogPakFile, Display, TEXT("Verified %d files, %.2f GB in %.2f seconds (%.2f GB/s)"), files, gigabytes, seconds, seconds > 0 ? gigabytes / seconds : 0.0);
+
+    if (corruptFiles > 0) {
+        UE_LOG(LogPakFile, Error, TEXT("%d of %d files are corrupt."), corruptFiles, files);
+        return false;
+    }
+
+    return bSuccess;
+}
+} // namespace uetools
@@ -0,0 +1,180 @@
+﻿#include "Async/Async.h"
+#include "HAL/FileManagerGeneric.h"
+#include "HAL/PlatformFileManager.h"
+#include "ExtractStats.h"
+#include "PakTools.h"
+#include "WriteBehindQueue.h"
+
+namespace uetools {
+constexpr int32 GMaxWriteBatch = 64;                      // Requests taken from the queue at once by a write thread
+constexpr uint32 GPreallocatedWriterBufferSize = 1 << 20; // Decoded blocks are gathered into 1MB writes
+
+FWriteBehindQueue::FWriteBehindQueue(int32 numThreads, int64 maxQueuedBytes)
+    : MaxQueuedBytes(maxQueuedBytes) {
+    for (int32 threadIndex = 0; threadIndex < numThreads; threadIndex++) {
+        Writers.Add(Async(EAsyncExecution::Thread, [this] { WriterLoop(); }));
+    }
+}
+
+FWriteBehindQueue::~FWriteBehindQueue() {
+    Flush();
+    {
+        FScopeLock lock(&QueueLock);
+        bStopping = true;
+    }
+    // Each writer wakes the next one on its way out
+    WorkAvailable->Trigger();
+    for (TFuture<void> &writer : Writers) {
+        writer.Wait();
+    }
+}
+
+void FWriteBehindQueue::Enqueue(FString &&filename, FIoBuffer &&data) {
+    const int64 size = int64(data.DataSize());
+    for (;;) {
+        {
+            FScopeLock lock(&QueueLock);
+            // A file larger than the whole budget is still accepted once the queue is empty
+            if (QueuedBytes == 0 || QueuedBytes + size <= MaxQueuedBytes) {
+                QueuedBytes += size;
+                Pending.Add({MoveTemp(filename), MoveTemp(data)});
+                // Pass the wakeup on to another blocked worker while there is budget left
+                if (QueuedBytes < MaxQueuedBytes) {
+                    SpaceAvailable->Trigger();
+                }
+                break;
+            }
+        }
+        SpaceAvailable->Wait();
+    }
+    WorkAvailable->Trigger();
+}
+
+void FWriteBehindQueue::Flush() {
+    for (;;) {
+        {
+            FScopeLock lock(&QueueLock);
+            if (Pending.Num() == 0 && ActiveWriters == 0) {
+                return;
+            }
+        }
+        Idle->Wait();
+    }
+}
+
+TSet<FString> FWriteBehindQueue::GetFailedFiles() {
+    FScopeLock lock(&FailedFilesLock);
+    return FailedFiles;
+}
+
+bool FWriteBehindQueue::MakeParentDirectory(const FString &filename) {
+    const FString directory = FPaths::GetPath(filename);
+    {
+        FReadScopeLock lock(DirectoriesLock);
+        if (CreatedDirectories.Contains(directory)) {
+            return true;
+        }
+    }
+
+    if (!FPlatformFileManager::Get().GetPlatformFile().CreateDirectoryTree(*directory)) {
+        return false;
+    }
+
+    FWriteScopeLock lock(DirectoriesLock);
+    CreatedDirectories.Add(directory);
+    return true;
+}
+
+FArchive *FWriteBehindQueue::CreatePreallocatedWriter(const FString &filename, int64 size) {
+    if (!MakeParentDirectory(filename)) {
+        return nullptr;
+    }
+
+    UnlinkOutputFile(filename);
+    IFileHandle *handle = FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*filename);
+    if (handle == nullptr) {
+        return nullptr;
+    }
+
+    // Setting the final size up front lets the filesystem allocate the file once instead of growing it block by block
+    if (size > 0 && handle->Truncate(size)) {
+        handle->Seek(0);
+    }
+    return new FArchiveFileWriterGeneric(handle, *filename, 0, GPreallocatedWriterBufferSize);
+}
+
+void FWriteBehindQueue::WriterLoop() {
+    TArray<FWriteRequest> batch;
+    for (;;) {
+        {
+            FScopeLock lock(&QueueLock);
+            if (Pending.Num() > 0) {
+                const int32 numRequests = FMath::Min(Pending.Num(), GMaxWriteBatch);
+                for (int32 requestIndex = 0; requestIndex < numRequests; requestIndex++) {
+                    batch.Add(MoveTemp(Pending[requestIndex]));
+                }
+                Pending.RemoveAt(0, numRequests, false);
+                ActiveWriters++;
+            }
+            // Enqueue triggers the event once per file but an auto-reset event wakes a single writer, which passes the wakeup on while requests
+            // remain, and on shutdown
+            if (Pending.Num() > 0 || bStopping) {
+                WorkAvailable->Trigger();
+            }
+            if (batch.Num() == 0 && bStopping) {
+                return;
+            }
+        }
+        if (batch.Num() == 0) {
+            WorkAvailable->Wait();
+            continue;
+        }
+
+        int64 batchBytes = 0;
+        for (const FWriteRequest &request : batch) {
+            if (!WriteFile(request)) {
+                UE_LOG(LogPakFile, Error, TEXT("Unable to write file \"%s\"."), *request.Filename);
+                FScopeLock lock(&FailedFilesLock);
+                FailedFiles.Add(request.Filename);
+            }
+            batchBytes += int64(request.Data.DataSize());
+        }
+        batch.Reset();
+
+        // The budget covers the data being written, so it is only released once the batch is on disk
+        {
+            FScopeLock lock(&QueueLock);
+            QueuedBytes -= batchBytes;
+            ActiveWriters--;
+            if (Pending.Num() == 0 && ActiveWriters == 0) {
+                Idle->Trigger();
+            }
+        }
+        SpaceAvailable->Trigger();
+    }
+}
+
+bool FWriteBehindQueue::WriteFile(const FWriteRequest &request) {
+    TUniquePtr<IFileHandle> handle;
+    {
+        PAKTOOLS_STAGE_SCOPE(Create, int64(request.Data.DataSize()));
+        if (!MakeParentDirectory(request.Filename)) {
+            return false;
+        }
+        UnlinkOutputFile(request.Filename);
+        handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*request.Filename));
+    }
+    if (!handle) {
+        return false;
+    }
+
+    PAKTOOLS_STAGE_SCOPE(Write, int64(request.Data.DataSize()));
+    if (request.Data.DataSize() > 0 && !handle->Write(request.Data.GetData(), int64(request.Data.DataSize()))) {
+        // A partial file must not be taken for a complete one by the next incremental run
+        handle.Reset();
+        UnlinkOutputFile(request.Filename);
+        return false;
+    }
+    return true;
+}
+} // namespace uetools
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Async/Future.h"
+#include "CoreMinimal.h"
+#include "HAL/Event.h"
+#include "IoDispatcher.h"
+
+namespace uetools {
+constexpr int64 GMaxWriteBehindFileSize = 4 * 1024 * 1024; // Larger pak entries are written by the worker, through a preallocated writer
+
+// Writes extracted files on background threads fed by a bounded queue, so the workers go back to reading and decoding while the filesystem catches up.
+// Directories created by the queue are remembered, files are created and written with a single call each.
+class FWriteBehindQueue {
+  public:
+    FWriteBehindQueue(int32 numThreads, int64 maxQueuedBytes);
+    ~FWriteBehindQueue();
+
+    // Blocks while the queued data is over budget
+    void Enqueue(FString &&filename, FIoBuffer &&data);
+    // Waits until every queued file is written
+    void Flush();
+    // Files that could not be written since the queue was created
+    TSet<FString> GetFailedFiles();
+
+    // Creates the directory of the file unless this queue already did
+    bool MakeParentDirectory(const FString &filename);
+    // Writer for files too large to be queued, created in a cached directory and preallocated to its final size
+    FArchive *CreatePreallocatedWriter(const FString &filename, int64 size);
+
+  private:
+    struct FWriteRequest {
+        FString Filename;
+        FIoBuffer Data;
+    };
+
+    void WriterLoop();
+    bool WriteFile(const FWriteRequest &request);
+
+    // Guards the pending requests and counters, the auto-reset events wake the threads waiting for them to change
+    FCriticalSection QueueLock;
+    FEventRef WorkAvailable;
+    FEventRef SpaceAvailable;
+    FEventRef Idle;
+    TArray<FWriteRequest> Pending;
+    int64 QueuedBytes = 0;
+    int64 MaxQueuedBytes;
+    int32 ActiveWriters = 0;
+    bool bStopping = false;
+    TArray<TFuture<void>> Writers;
+
+    FRWLock DirectoriesLock;
+    TSet<FString> CreatedDirectories;
+    FCriticalSection FailedFilesLock;
+    TSet<FString> FailedFiles;
+};
+} // namespace uetools